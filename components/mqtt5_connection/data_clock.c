@@ -0,0 +1,144 @@
+#include "data_clock.h"
+
+#include "wifi_utils_sntp.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include <string.h>
+#include <sys/time.h>
+
+static const char *TAG = "data_clock";
+
+/** @brief NVS namespace holding the boot id and the offsets. */
+#define CLOCK_NAMESPACE "data_clock"
+/** @brief NVS key of the id of the last boot. */
+#define BOOT_ID_KEY "boot_id"
+/** @brief NVS key of the offsets of the last boots. */
+#define OFFSETS_KEY "offsets"
+/** @brief Largest offset accepted as valid, about 100 years. */
+#define MAX_OFFSET_S (100LL * 366 * 24 * 60 * 60)
+
+/**
+ * @brief Offset of the unsynced clock of one boot.
+ *
+ */
+struct data_clock_offset_t {
+  uint16_t boot_id; // boot the offset belongs to, 0 if unused
+  uint16_t reserved[3];
+  int64_t offset; // seconds added to the unsynced timestamps
+};
+
+/** @brief Offsets of the last boots, indexed by boot id. */
+static struct data_clock_offset_t offsets_[DATA_CLOCK_NR_BOOTS];
+/** @brief Id of the current boot, 0 is never used. */
+static uint16_t boot_id_ = 0;
+/** @brief Difference between the unsynced clock and the uptime in us. */
+static int64_t unsynced_base_us_ = 0;
+/** @brief Set if the time was already synchronized at the initialization. */
+static bool is_synced_at_init_ = false;
+
+/**
+ * @brief Get the difference between the clock and the uptime.
+ *
+ * @return int64_t difference in microseconds
+ */
+static int64_t clock_base_us() {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return (int64_t)now.tv_sec * 1000000 + now.tv_usec - esp_timer_get_time();
+}
+
+void data_clock_init() {
+  is_synced_at_init_ = wifi_utils_is_time_synced();
+  unsynced_base_us_ = clock_base_us();
+  nvs_handle_t handle;
+  esp_err_t err = nvs_open(CLOCK_NAMESPACE, NVS_READWRITE, &handle);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Can not open NVS: %s", esp_err_to_name(err));
+    return;
+  }
+  uint16_t last_boot_id = 0;
+  nvs_get_u16(handle, BOOT_ID_KEY, &last_boot_id);
+  boot_id_ = last_boot_id + 1;
+  if (boot_id_ == 0) {
+    boot_id_ = 1; // 0 marks records of unknown boots
+  }
+  ESP_ERROR_CHECK_WITHOUT_ABORT(nvs_set_u16(handle, BOOT_ID_KEY, boot_id_));
+  ESP_ERROR_CHECK_WITHOUT_ABORT(nvs_commit(handle));
+  // Offsets saved in another format have a different size and are dropped.
+  size_t size = sizeof(offsets_);
+  if (nvs_get_blob(handle, OFFSETS_KEY, offsets_, &size) != ESP_OK ||
+      size != sizeof(offsets_)) {
+    memset(offsets_, 0, sizeof(offsets_));
+  }
+  nvs_close(handle);
+  ESP_LOGI(TAG, "Boot %u", boot_id_);
+}
+
+uint16_t data_clock_boot_id() { return boot_id_; }
+
+bool data_clock_is_synced() { return wifi_utils_is_time_synced(); }
+
+void data_clock_synced() {
+  struct data_clock_offset_t *entry =
+      &offsets_[boot_id_ % DATA_CLOCK_NR_BOOTS];
+  if (is_synced_at_init_ || boot_id_ == 0 || entry->boot_id == boot_id_) {
+    return;
+  }
+  const int64_t offset_us = clock_base_us() - unsynced_base_us_;
+  const int64_t offset = (offset_us + 500000) / 1000000;
+  if (offset > MAX_OFFSET_S || offset < -MAX_OFFSET_S) {
+    // The records of this boot stay unsynced instead of being moved to a
+    // wrong time.
+    ESP_LOGW(TAG, "Offset of %lld s of boot %u is out of range",
+             (long long)offset, boot_id_);
+    return;
+  }
+  // Replaces the offset of the boot DATA_CLOCK_NR_BOOTS boots ago.
+  *entry = (struct data_clock_offset_t){
+      .boot_id = boot_id_,
+      .offset = offset,
+  };
+  ESP_LOGI(TAG, "Unsynced records of boot %u are rebased by %lld s", boot_id_,
+           (long long)entry->offset);
+
+  nvs_handle_t handle;
+  esp_err_t err = nvs_open(CLOCK_NAMESPACE, NVS_READWRITE, &handle);
+  if (err == ESP_OK) {
+    err = nvs_set_blob(handle, OFFSETS_KEY, offsets_, sizeof(offsets_));
+    if (err == ESP_OK) {
+      err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+  }
+  if (err != ESP_OK) {
+    // Records of this boot are still rebased until the next reboot.
+    ESP_LOGW(TAG, "Can not save the offset: %s", esp_err_to_name(err));
+  }
+}
+
+enum data_clock_quality data_clock_rebase(uint16_t boot_id, bool is_unsynced,
+                                          time_t *timestamp) {
+  if (!is_unsynced) {
+    return DATA_CLOCK_SYNCED;
+  }
+  const struct data_clock_offset_t *entry =
+      &offsets_[boot_id % DATA_CLOCK_NR_BOOTS];
+  if (boot_id == 0 || entry->boot_id != boot_id) {
+    return DATA_CLOCK_UNSYNCED;
+  }
+  *timestamp += entry->offset;
+  return DATA_CLOCK_REBASED;
+}
+
+const char *data_clock_quality_name(enum data_clock_quality quality) {
+  switch (quality) {
+  case DATA_CLOCK_SYNCED:
+    return "synced";
+  case DATA_CLOCK_REBASED:
+    return "rebased";
+  default:
+    return "unsynced";
+  }
+}
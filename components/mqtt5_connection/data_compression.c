@@ -0,0 +1,194 @@
+#include "data_compression.h"
+
+#include <math.h>
+#include <string.h>
+
+/**
+ * @brief Read a compressed field of a record.
+ *
+ * @param field field to read
+ * @param record record to read from
+ * @return int64_t value of the field
+ */
+static int64_t read_field(const struct data_compression_field_t *field,
+                          const struct data_logging_record_t *record) {
+  const uint8_t *data = (const uint8_t *)record + field->offset;
+  switch (field->size) {
+  case 1:
+    return field->is_signed ? *(const int8_t *)data : *data;
+  case 2: {
+    uint16_t value;
+    memcpy(&value, data, sizeof(value));
+    return field->is_signed ? (int16_t)value : value;
+  }
+  case 4: {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return field->is_signed ? (int64_t)(int32_t)value : (int64_t)value;
+  }
+  default: {
+    int64_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+  }
+  }
+}
+
+/**
+ * @brief Get the seconds between the kept record and a newer record.
+ *
+ * Records within the same second are treated as one second apart.
+ *
+ * @param compression state of the stream
+ * @param record newer record
+ * @return float seconds, at least 1
+ */
+static float seconds_since_kept(const struct data_compression_t *compression,
+                                const struct data_logging_record_t *record) {
+  const time_t seconds = record->timestamp - compression->kept.timestamp;
+  return seconds > 1 ? (float)seconds : 1.0f;
+}
+
+/**
+ * @brief Keep a record and open the doors of the swinging door again.
+ *
+ * @param compression state of the stream
+ * @param record record to keep
+ */
+static void keep_record(struct data_compression_t *compression,
+                        const struct data_logging_record_t *record) {
+  compression->kept = *record;
+  compression->has_kept = true;
+  for (unsigned int i = 0; i < compression->nr_fields; i++) {
+    compression->lower_slopes[i] = -INFINITY;
+    compression->upper_slopes[i] = INFINITY;
+  }
+}
+
+/**
+ * @brief Check a newer record against the doors and narrow them by it.
+ *
+ * The doors of a field limit the slopes of the lines from the kept record
+ * which pass all records in between within the tolerance.
+ *
+ * @param compression state of the stream
+ * @param record newer record
+ * @return true if the line from the kept record to the newer record passes
+ * all records in between within the tolerance
+ */
+static bool narrow_doors(struct data_compression_t *compression,
+                         const struct data_logging_record_t *record) {
+  const float seconds = seconds_since_kept(compression, record);
+  bool is_open = true;
+  for (unsigned int i = 0; i < compression->nr_fields; i++) {
+    const struct data_compression_field_t *field = &compression->fields[i];
+    const float delta = (float)(read_field(field, record) -
+                                read_field(field, &compression->kept));
+    const float slope = delta / seconds;
+    if (slope < compression->lower_slopes[i] ||
+        slope > compression->upper_slopes[i]) {
+      is_open = false;
+    }
+    const float lower = (delta - field->tolerance) / seconds;
+    const float upper = (delta + field->tolerance) / seconds;
+    if (lower > compression->lower_slopes[i]) {
+      compression->lower_slopes[i] = lower;
+    }
+    if (upper < compression->upper_slopes[i]) {
+      compression->upper_slopes[i] = upper;
+    }
+  }
+  return is_open;
+}
+
+/**
+ * @brief Check if a field of a record left the deadband around the kept
+ * record.
+ *
+ * @param compression state of the stream
+ * @param record newer record
+ * @return true if the record needs to be kept
+ */
+static bool is_outside_deadband(const struct data_compression_t *compression,
+                                const struct data_logging_record_t *record) {
+  for (unsigned int i = 0; i < compression->nr_fields; i++) {
+    const struct data_compression_field_t *field = &compression->fields[i];
+    const int64_t delta =
+        read_field(field, record) - read_field(field, &compression->kept);
+    if (delta > (int64_t)field->tolerance ||
+        -delta > (int64_t)field->tolerance) {
+      return true;
+    }
+  }
+  return false;
+}
+
+unsigned int data_compression_add(struct data_compression_t *compression,
+                                  const struct data_logging_record_t *record,
+                                  struct data_logging_record_t *out) {
+  compression->nr_received++;
+  if (compression->mode == DATA_COMPRESSION_NONE) {
+    out[0] = *record;
+    return 1;
+  }
+  unsigned int nr_out = 0;
+  if (compression->has_kept &&
+      record->clock_unsynced != compression->kept.clock_unsynced) {
+    // The time jumped with the synchronization, start over.
+    if (compression->has_held) {
+      out[nr_out++] = compression->held;
+      compression->has_held = false;
+    }
+    compression->has_kept = false;
+  }
+  const bool is_due =
+      !compression->has_kept ||
+      record->timestamp - compression->kept.timestamp >=
+          (time_t)compression->max_interval;
+  if (compression->mode == DATA_COMPRESSION_DEADBAND) {
+    if (!is_due && !is_outside_deadband(compression, record)) {
+      compression->nr_dropped++;
+      return nr_out;
+    }
+    keep_record(compression, record);
+    out[nr_out++] = *record;
+    return nr_out;
+  }
+
+  // The doors are fully open until a record is held.
+  if (compression->has_kept && !narrow_doors(compression, record) &&
+      compression->has_held) {
+    // The held record is the last one reachable by a straight line.
+    keep_record(compression, &compression->held);
+    out[nr_out++] = compression->held;
+    compression->has_held = false;
+    narrow_doors(compression, record);
+  }
+  if (compression->has_held) {
+    // The line to the new record passes the held one within its tolerance.
+    compression->nr_dropped++;
+    compression->has_held = false;
+  }
+  if (is_due || is_outside_deadband(compression, record)) {
+    // A step is logged at once instead of when the next record arrives.
+    keep_record(compression, record);
+    out[nr_out++] = *record;
+    return nr_out;
+  }
+  compression->held = *record;
+  compression->has_held = true;
+  return nr_out;
+}
+
+bool data_compression_release(struct data_compression_t *compression,
+                              time_t held_before,
+                              struct data_logging_record_t *out) {
+  if (!compression->has_held ||
+      compression->held.timestamp >= held_before) {
+    return false;
+  }
+  keep_record(compression, &compression->held);
+  *out = compression->held;
+  compression->has_held = false;
+  return true;
+}
@@ -0,0 +1,136 @@
+#ifndef COMPONENTS_MQTT5_CONNECTION_DATA_COMPRESSION
+#define COMPONENTS_MQTT5_CONNECTION_DATA_COMPRESSION
+/**
+ * @brief Lossy compression of numeric records before they are logged.
+ *
+ * Only the records needed to reconstruct each compressed field within its
+ * tolerance are kept. Fields without a tolerance are passed along with the
+ * kept records.
+ *
+ * Deadband keeps a record if a field differs from the last kept record by more
+ * than its tolerance.
+ *
+ * Swinging door keeps a record if the straight line from the last kept record
+ * to the newest record leaves the tolerance band of a record in between.
+ * Therefore the newest record is held back until the next record shows if it
+ * is needed, unless it differs from the last kept record by more than the
+ * tolerance. Linear interpolation between the kept records reconstructs the
+ * signal.
+ *
+ * With both modes a record is kept at least every max_interval seconds.
+ *
+ */
+
+#include "data_logging_ring.h"
+#include <stddef.h>
+
+/** @brief Maximum number of compressed fields of a record. */
+#define DATA_COMPRESSION_MAX_FIELDS 4
+
+/**
+ * @brief Compression mode of a stream.
+ *
+ */
+enum data_compression_mode {
+  DATA_COMPRESSION_NONE = 0,
+  DATA_COMPRESSION_DEADBAND = 1,
+  DATA_COMPRESSION_SWINGING_DOOR = 2,
+};
+
+/**
+ * @brief Description of a compressed field of a data_logging_record_t.
+ *
+ */
+struct data_compression_field_t {
+  size_t offset;      // offset of the field in the record
+  uint8_t size;       // size of the field in bytes
+  bool is_signed;     // true if the field is a signed integer
+  uint32_t tolerance; // allowed deviation of the reconstructed signal
+};
+
+/**
+ * @brief Describe a compressed field of a data_logging_record_t.
+ *
+ * @param member member of the record, e.g. memory.free_heap_size
+ * @param is_signed_member true if the member is a signed integer
+ * @param field_tolerance allowed deviation of the reconstructed signal
+ */
+#define DATA_COMPRESSION_FIELD(member, is_signed_member, field_tolerance)      \
+  {                                                                            \
+      .offset = offsetof(struct data_logging_record_t, member),                \
+      .size = sizeof(((struct data_logging_record_t *)0)->member),             \
+      .is_signed = is_signed_member,                                           \
+      .tolerance = field_tolerance,                                            \
+  }
+
+/**
+ * @brief Compression state of one stream.
+ *
+ * Only used by the data logging task.
+ */
+struct data_compression_t {
+  enum data_compression_mode mode;
+  const struct data_compression_field_t *fields;
+  unsigned int nr_fields;
+  // seconds after which a record is kept anyway
+  uint32_t max_interval;
+  bool has_kept;                     // true if a record was kept before
+  bool has_held;                     // true if the newest record is held back
+  struct data_logging_record_t kept; // last kept record
+  struct data_logging_record_t held; // newest record, swinging door only
+  // swinging door: slopes of the doors of each field since the kept record
+  float lower_slopes[DATA_COMPRESSION_MAX_FIELDS];
+  float upper_slopes[DATA_COMPRESSION_MAX_FIELDS];
+  unsigned int nr_received; // records passed to the compression
+  unsigned int nr_dropped;  // records dropped by the compression
+};
+
+/**
+ * @brief Define the compression state of a stream.
+ *
+ * @param var name of the state
+ * @param compression_mode mode, see data_compression_mode
+ * @param field_array array of data_compression_field_t
+ * @param max_interval_s seconds after which a record is kept anyway
+ */
+#define DATA_COMPRESSION_DEFINE(var, compression_mode, field_array,            \
+                                max_interval_s)                                \
+  _Static_assert(sizeof(field_array) / sizeof(field_array[0]) <=               \
+                     DATA_COMPRESSION_MAX_FIELDS,                              \
+                 "Too many compressed fields");                                \
+  static struct data_compression_t var = {                                     \
+      .mode = compression_mode,                                                \
+      .fields = field_array,                                                   \
+      .nr_fields = sizeof(field_array) / sizeof(field_array[0]),               \
+      .max_interval = max_interval_s,                                          \
+  }
+
+/**
+ * @brief Pass a new record through the compression.
+ *
+ * @param compression state of the stream
+ * @param record new record
+ * @param out output for the records to log, oldest first. Needs space for two
+ * records.
+ * @return unsigned int number of records to log
+ */
+unsigned int data_compression_add(struct data_compression_t *compression,
+                                  const struct data_logging_record_t *record,
+                                  struct data_logging_record_t *out);
+
+/**
+ * @brief Keep the held record if it is older than the given time.
+ *
+ * Called periodically, so the last record of a stream is not held back until
+ * the next record arrives.
+ *
+ * @param compression state of the stream
+ * @param held_before release the held record if its timestamp is before
+ * @param out output for the released record
+ * @return true if a record was released
+ */
+bool data_compression_release(struct data_compression_t *compression,
+                              time_t held_before,
+                              struct data_logging_record_t *out);
+
+#endif /* COMPONENTS_MQTT5_CONNECTION_DATA_COMPRESSION */
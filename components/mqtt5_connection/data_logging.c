@@ -1,15 +1,25 @@
 #include "data_logging.h"
 
 #include "configuration.h"
-#include "light_data_store.h"
-#include "memory_data_store.h"
+#include "data_clock.h"
+#include "data_compression.h"
+#include "data_logging_ring.h"
+#include "data_query.h"
+#include "data_rollup.h"
+#include "data_shipping.h"
+#include "data_store.h"
+#include "data_stream.h"
 #include "mqtt5_connection.h"
-#include "pump_data_store.h"
+#include "wifi_utils_sntp.h"
+#include "wifi_utils_sta.h"
 
+#include "esp_heap_caps.h"
 #include "esp_log.h"
-#include "esp_spiffs.h"
+#include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_vfs.h"
 #include "freertos/queue.h"
+#include "nvs.h"
 #include <dirent.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -19,10 +29,14 @@
 #include <time.h>
 #include <unistd.h>
 
-/** @brief Timeout waiting for sending data via mqtt */
-#define TIMEOUT_SENT_DATA 1 * 60 * 1000 / portTICK_PERIOD_MS // 1 minute
-/** @brief Timeout waiting after disconnected or if nothing to do. */
-#define TIMEOUT_DISCONNECTED 2 * 60 * 60 * 1000 / portTICK_PERIOD_MS // 2 hours
+/** @brief Time without acknowledgement after which records are sent again. */
+#define SENT_DATA_TIMEOUT_US (60 * 1000000LL) // 1 minute
+/** @brief Interval of the storage maintenance while nothing is sent. */
+#define IDLE_PERIOD_US (10 * 60 * 1000000LL) // 10 minutes
+/** @brief NVS namespace holding the running pump cycle. */
+#define DATA_LOGGING_NAMESPACE "data_logging"
+/** @brief NVS key of the running pump cycle. */
+#define PUMP_CYCLE_KEY "pump_cycle"
 
 static const char *TAG = "data_logging";
 
@@ -49,11 +63,29 @@ static StaticQueue_t event_queue_;
  * @brief Handle to the event queue used for communication between tasks.
  */
 static QueueHandle_t event_queue_handle_;
+/** @brief Events dropped since boot because the queue was full. */
+static atomic_uint nr_dropped_events_ = 0;
+/**
+ * @brief Maximum number of directly published records waiting for their
+ * acknowledgement.
+ */
+#define MAX_DIRECT_RECORDS 8
+#if CONFIG_MQTT_DATA_BULK_SHIPPING
+#define BULK_WINDOW CONFIG_MQTT_DATA_BULK_WINDOW
+#else
+#define BULK_WINDOW 0
+#endif
 /**
  * @brief Length of the queue.
  *
+ * Holds the acknowledgements of all data messages which may wait for one at
+ * once, plus the control events and the acknowledgements of other messages.
+ * Events are posted without waiting, as the MQTT task holds the client lock
+ * which the data logging task may wait for.
  */
-#define QUEUE_LENGTH 10
+#define QUEUE_LENGTH                                                           \
+  (DATA_LOGGING_NR_RECORD_TYPES * DATA_STORE_MAX_IN_FLIGHT +                   \
+   MAX_DIRECT_RECORDS + BULK_WINDOW + 8)
 /**
  * @brief Size of one queue item in bytes.
  *
@@ -66,16 +98,46 @@ static QueueHandle_t event_queue_handle_;
  */
 static uint8_t event_queue_storage_area[QUEUE_LENGTH * EVENT_QUEUE_ITEM_SIZE];
 
-static int current_data_id_ = -1;
+/**
+ * @brief Handle of the data logging task, notified on new records and events.
+ *
+ */
+static TaskHandle_t data_logging_task_handle_ = NULL;
+
+/** @brief Records of the pump control task. */
+static struct data_logging_ring_t pump_ring_;
+/** @brief Records of the light control task. */
+static struct data_logging_ring_t light_ring_;
+/** @brief Records of the telemetry sampler. */
+static struct data_logging_ring_t telemetry_ring_;
+/** @brief Timer sampling the system telemetry. */
+static esp_timer_handle_t telemetry_timer_ = NULL;
 
-enum data_store_type {
-  UNKNOWN,
-  MEMORY_DATA_STORE,
-  PUMP_DATA_STORE,
-  LIGHT_DATA_STORE,
+/** @brief True while connected to the MQTT broker. */
+static bool is_connected_ = false;
+
+/**
+ * @brief Record published without passing its data store.
+ *
+ * Kept until the record is acknowledged, so it can still be stored.
+ */
+struct direct_record_t {
+  int msg_id;                          // message id of the published record
+  struct data_logging_record_t record; // record to store if not acknowledged
 };
 
-static enum data_store_type current_data_store_ = UNKNOWN;
+static struct direct_record_t direct_records_[MAX_DIRECT_RECORDS];
+static unsigned int nr_direct_records_ = 0;
+
+/**
+ * @brief Time of the last acknowledgement, or of the last time nothing waited
+ * for one.
+ */
+static int64_t last_progress_us_ = 0;
+/** @brief Time of the last storage maintenance. */
+static int64_t last_idle_us_ = 0;
+/** @brief Time the backlog status was sent last. */
+static int64_t last_backlog_us_ = 0;
 
 // void list_dir(char *path) {
 //   DIR *dp;
@@ -92,242 +154,792 @@ static enum data_store_type current_data_store_ = UNKNOWN;
 //   }
 // }
 
+/**
+ * @brief Wake up the data logging task.
+ *
+ */
+static inline void notify_data_logging_task() {
+  if (data_logging_task_handle_ != NULL) {
+    xTaskNotifyGive(data_logging_task_handle_);
+  }
+}
+
+/**
+ * @brief Hand an event to the data logging task without waiting.
+ *
+ * A dropped acknowledgement is recovered by sending the data again after
+ * SENT_DATA_TIMEOUT_US.
+ *
+ * @param event event to post
+ */
+static void post_event(const struct data_logging_event_t *event) {
+  if (xQueueSendToBack(event_queue_handle_, event, 0) != pdTRUE) {
+    atomic_fetch_add(&nr_dropped_events_, 1);
+    ESP_LOGW(TAG, "Event queue full, dropping event %d", event->type);
+  }
+  notify_data_logging_task();
+}
+
 void set_connected() {
   ESP_LOGD(TAG, "Setting connected state");
-  xQueueSendToBack(
-      event_queue_handle_,
-      &(struct data_logging_event_t){.type = DATA_LOGGING_EVENT_CONNECTED},
-      portMAX_DELAY);
+  post_event(
+      &(struct data_logging_event_t){.type = DATA_LOGGING_EVENT_CONNECTED});
 }
 
 void set_disconnected() {
   ESP_LOGD(TAG, "Setting disconnected state");
-  xQueueSendToBack(
-      event_queue_handle_,
-      &(struct data_logging_event_t){.type = DATA_LOGGING_EVENT_DISCONNECTED},
-      portMAX_DELAY);
+  post_event(
+      &(struct data_logging_event_t){.type = DATA_LOGGING_EVENT_DISCONNECTED});
 }
 
 void set_data_published(unsigned int id) {
   ESP_LOGD(TAG, "Setting data published state");
-  xQueueSendToBack(event_queue_handle_,
-                   (&(struct data_logging_event_t){
-                       .type = DATA_LOGGING_EVENT_DATA_PUBLISHED, .id = id}),
-                   portMAX_DELAY);
-}
-
-bool schedule_next_memory_data_send() {
-  static struct memory_data_item_t memory_data_item;
-  const bool data_available =
-      memory_data_store_pop_and_stash(&memory_data_item);
-  if (!data_available) {
-    ESP_LOGD(TAG, "No memorydata available to send");
-    return false;
+  post_event(&(struct data_logging_event_t){
+      .type = DATA_LOGGING_EVENT_DATA_PUBLISHED, .id = id});
+}
+
+void set_data_query_received() {
+  ESP_LOGD(TAG, "Setting data query received state");
+  post_event(
+      &(struct data_logging_event_t){.type = DATA_LOGGING_EVENT_DATA_QUERY});
+}
+
+void set_clock_synced() {
+  ESP_LOGD(TAG, "Setting clock synced state");
+  post_event(
+      &(struct data_logging_event_t){.type = DATA_LOGGING_EVENT_CLOCK_SYNCED});
+}
+
+/**
+ * @brief Records of a stream waiting for their acknowledgement.
+ *
+ * The broker acknowledges the records in the order they were published, so an
+ * acknowledgement commits all older records of the store as well.
+ */
+struct data_sender_t {
+  int msg_ids[DATA_STORE_MAX_IN_FLIGHT]; // message ids, oldest first
+  unsigned int nr_in_flight;             // number of unacknowledged records
+  // records acknowledged since the last backlog status
+  unsigned int nr_sent;
+};
+
+/** @brief Senders of all streams, indexed like data_streams. */
+static struct data_sender_t senders_[DATA_LOGGING_NR_RECORD_TYPES];
+
+/**
+ * @brief Read all unacknowledged records of a stream again.
+ *
+ * @param i index of the stream
+ * @return true if records waited for their acknowledgement
+ */
+static bool rollback_sender(unsigned int i) {
+  const bool is_in_flight = senders_[i].nr_in_flight > 0;
+  data_store_rollback(data_streams[i].store);
+  senders_[i].nr_in_flight = 0;
+  return is_in_flight;
+}
+
+/**
+ * @brief Schedule the next data send operations.
+ *
+ * Publishes records of each data store until DATA_STORE_MAX_IN_FLIGHT records
+ * of the store wait for their acknowledgement.
+ */
+static void schedule_next_data_send() {
+#if CONFIG_MQTT_DATA_BULK_SHIPPING
+  // Stored segments are shipped before the records in RAM are sent.
+  if (data_shipping_schedule()) {
+    ESP_LOGD(TAG, "Shipping stored data segments");
+    return;
   }
-  cJSON *data = memory_data_item_to_json(&memory_data_item);
-  char *data_json_string = cJSON_PrintUnformatted(data);
-  cJSON_Delete(data);
-  current_data_id_ = mqtt5_sent_message("ef/efc/timed/heap", data_json_string);
-  cJSON_free(data_json_string);
+#endif
+  static struct data_logging_record_t record;
+  for (unsigned int i = 0; i < DATA_LOGGING_NR_RECORD_TYPES; i++) {
+    const struct data_stream_t *stream = &data_streams[i];
+    struct data_sender_t *sender = &senders_[i];
+    while (sender->nr_in_flight < DATA_STORE_MAX_IN_FLIGHT &&
+           data_stream_read(stream, &record)) {
+      const int msg_id = data_stream_publish(stream, &record);
+      if (msg_id < 0) {
+        ESP_LOGW(TAG, "Failed to send %s data", stream->store->name);
+        rollback_sender(i);
+        break;
+      }
+      if (stream->qos == 0) {
+        // Never acknowledged, the record is gone once it is sent.
+        data_store_commit(stream->store, 1);
+        sender->nr_sent++;
+        continue;
+      }
+      sender->msg_ids[sender->nr_in_flight++] = msg_id;
+    }
+    ESP_LOGD(TAG, "%u %s records wait for their acknowledgement",
+             sender->nr_in_flight, stream->store->name);
+  }
+}
+
+/**
+ * @brief Read all unacknowledged records of the data stores again.
+ *
+ * @return true if records waited for their acknowledgement
+ */
+static bool restore_scheduled_data() {
+  bool is_in_flight = false;
+  for (unsigned int i = 0; i < DATA_LOGGING_NR_RECORD_TYPES; i++) {
+    is_in_flight = rollback_sender(i) || is_in_flight;
+  }
+  return is_in_flight;
+}
 
-  if (current_data_id_ < 0) {
-    ESP_LOGW(TAG, "Failed to send memory data");
-    memory_data_store_restore_stack();
+/**
+ * @brief Commit the acknowledged record and all older ones of its data store.
+ *
+ * @param id message id of the published message
+ * @return true if the message was a record of a data store
+ */
+static bool scheduled_data_published(int id) {
+  for (unsigned int i = 0; i < DATA_LOGGING_NR_RECORD_TYPES; i++) {
+    struct data_sender_t *sender = &senders_[i];
+    for (unsigned int j = 0; j < sender->nr_in_flight; j++) {
+      if (sender->msg_ids[j] != id) {
+        continue;
+      }
+      const unsigned int nr_committed = j + 1;
+      data_store_commit(data_streams[i].store, nr_committed);
+      sender->nr_in_flight -= nr_committed;
+      sender->nr_sent += nr_committed;
+      memmove(sender->msg_ids, sender->msg_ids + nr_committed,
+              sender->nr_in_flight * sizeof(sender->msg_ids[0]));
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Push a record of a control task into the store of its stream.
+ *
+ * @param record record to store
+ * @return true if the record was stored
+ */
+static bool store_record(const struct data_logging_record_t *record) {
+  const struct data_stream_t *stream = data_stream_of(record);
+  if (stream == NULL) {
+    ESP_LOGE(TAG, "Unknown record type: %d", record->type);
     return false;
   }
+  data_store_push(stream->store, record);
   return true;
 }
 
-bool schedule_next_pump_data_send() {
-  static struct pump_data_item_t pump_data_item;
-  const bool data_available = pump_data_store_pop_and_stash(&pump_data_item);
-  if (!data_available) {
-    ESP_LOGD(TAG, "No pump data available to send");
-    return false;
+/**
+ * @brief Count the directly published records of a stream waiting for their
+ * acknowledgement.
+ *
+ * @param type record type of the stream
+ * @return unsigned int number of direct records
+ */
+static unsigned int nr_direct_records_of(enum data_logging_record_type type) {
+  unsigned int nr_direct = 0;
+  for (unsigned int i = 0; i < nr_direct_records_; i++) {
+    if (direct_records_[i].record.type == type) {
+      nr_direct++;
+    }
   }
-  cJSON *data = pump_data_item_to_json(&pump_data_item);
-  char *data_json_string = cJSON_PrintUnformatted(data);
-  cJSON_Delete(data);
-  current_data_id_ =
-      mqtt5_sent_message(CONFIG_MQTT_PUMP_STATUS_TOPIC, data_json_string);
-  cJSON_free(data_json_string);
+  return nr_direct;
+}
 
-  if (current_data_id_ < 0) {
-    ESP_LOGW(TAG, "Failed to send pump data");
-    pump_data_store_restore_stack();
+/**
+ * @brief Publish a record of a control task without passing its data store.
+ *
+ * Only possible while connected and if no older record of the stream waits in
+ * its store or is being sent, so the order of the records is kept. At most
+ * DATA_STORE_MAX_IN_FLIGHT records of a stream are published directly, so they
+ * can be handed over to the store, see hand_over_direct_records.
+ *
+ * @param stream stream of the record
+ * @param record record to publish
+ * @return true if the record was published
+ */
+static bool
+publish_record_directly(const struct data_stream_t *stream,
+                        const struct data_logging_record_t *record) {
+  if (!is_connected_ || nr_direct_records_ >= MAX_DIRECT_RECORDS ||
+      nr_direct_records_of(record->type) >= DATA_STORE_MAX_IN_FLIGHT ||
+      !data_store_is_empty(stream->store)) {
+    return false;
+  }
+  const int msg_id = data_stream_publish(stream, record);
+  if (msg_id < 0) {
     return false;
   }
+  if (stream->qos > 0) {
+    direct_records_[nr_direct_records_++] =
+        (struct direct_record_t){.msg_id = msg_id, .record = *record};
+  } else {
+    senders_[record->type].nr_sent++;
+  }
   return true;
 }
 
-bool schedule_next_light_data_send() {
-  static struct light_data_item_t light_data_item;
-  const bool data_available = light_data_store_pop_and_stash(&light_data_item);
-  if (!data_available) {
-    ESP_LOGD(TAG, "No light data available to send");
+/**
+ * @brief Forget a directly published record after its acknowledgement.
+ *
+ * @param id message id of the published message
+ * @return true if the message was a directly published record
+ */
+static bool direct_record_published(int id) {
+  for (unsigned int i = 0; i < nr_direct_records_; i++) {
+    if (direct_records_[i].msg_id == id) {
+      senders_[direct_records_[i].record.type].nr_sent++;
+      // Keep the publishing order for hand_over_direct_records.
+      nr_direct_records_--;
+      memmove(&direct_records_[i], &direct_records_[i + 1],
+              (nr_direct_records_ - i) * sizeof(direct_records_[0]));
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Hand the unacknowledged direct records of a stream over to its store.
+ *
+ * Called before a newer record of the stream is stored. The store is empty
+ * while the stream has direct records, so they are read again at once and
+ * wait for their acknowledgement like records read from the store. Thus the
+ * stream keeps its order and their acknowledgement commits them instead of
+ * them being published a second time.
+ *
+ * @param stream stream of the newer record
+ */
+static void hand_over_direct_records(const struct data_stream_t *stream) {
+  static struct data_logging_record_t record;
+  const unsigned int type = stream - data_streams;
+  struct data_sender_t *sender = &senders_[type];
+  unsigned int nr_kept = 0;
+  for (unsigned int i = 0; i < nr_direct_records_; i++) {
+    const struct direct_record_t *direct = &direct_records_[i];
+    if (direct->record.type != type) {
+      direct_records_[nr_kept++] = *direct;
+      continue;
+    }
+    data_store_push(stream->store, &direct->record);
+    if (sender->nr_in_flight < DATA_STORE_MAX_IN_FLIGHT &&
+        data_stream_read(stream, &record)) {
+      sender->msg_ids[sender->nr_in_flight++] = direct->msg_id;
+    }
+  }
+  nr_direct_records_ = nr_kept;
+}
+
+/**
+ * @brief Store all directly published records which are not acknowledged.
+ *
+ * Only called after a disconnect or a timeout, when no acknowledgement is
+ * expected anymore.
+ *
+ * @return true if at least one record was stored
+ */
+static bool restore_direct_records() {
+  bool is_stored = false;
+  for (unsigned int i = 0; i < nr_direct_records_; i++) {
+    is_stored = store_record(&direct_records_[i].record) || is_stored;
+  }
+  nr_direct_records_ = 0;
+  return is_stored;
+}
+
+/**
+ * @brief Handle one data logging event.
+ *
+ * @param event event to handle
+ */
+static void handle_event(const struct data_logging_event_t *event) {
+  switch (event->type) {
+  case DATA_LOGGING_EVENT_NEW_DATA:
+    ESP_LOGD(TAG, "New data event received");
+    schedule_next_data_send();
+    break;
+  case DATA_LOGGING_EVENT_CONNECTED:
+    ESP_LOGD(TAG, "Connected event received");
+    is_connected_ = true;
+    schedule_next_data_send();
+    break;
+  case DATA_LOGGING_EVENT_DISCONNECTED:
+    ESP_LOGD(TAG, "Disconnected event received");
+    is_connected_ = false;
+    restore_scheduled_data();
+    restore_direct_records();
+#if CONFIG_MQTT_DATA_BULK_SHIPPING
+    data_shipping_restore();
+#endif
+    break;
+  case DATA_LOGGING_EVENT_DATA_PUBLISHED:
+    ESP_LOGD(TAG, "Data published event received");
+    last_progress_us_ = esp_timer_get_time();
+    if (direct_record_published(event->id)) {
+      return;
+    }
+#if CONFIG_MQTT_DATA_BULK_SHIPPING
+    if (data_shipping_published(event->id)) {
+      schedule_next_data_send();
+      return;
+    }
+#endif
+    if (!scheduled_data_published(event->id)) {
+      ESP_LOGD(TAG, "Invalid data ID received");
+      return; // Skip processing if ID is invalid
+    }
+    schedule_next_data_send();
+    break;
+  case DATA_LOGGING_EVENT_DATA_QUERY:
+    ESP_LOGD(TAG, "Data query event received");
+    answer_data_query();
+    break;
+  case DATA_LOGGING_EVENT_CLOCK_SYNCED:
+    ESP_LOGD(TAG, "Clock synced event received");
+    data_clock_synced();
+    break;
+  default:
+    ESP_LOGE(TAG, "Unknown event type: %d", event->type);
+    break;
+  }
+}
+
+/**
+ * @brief Pass a record through the compression of its stream.
+ *
+ * @param record new record
+ * @param kept_records output for the records to log, space for two records
+ * @return unsigned int number of records to log
+ */
+static unsigned int
+compress_record(const struct data_logging_record_t *record,
+                struct data_logging_record_t *kept_records) {
+  const struct data_stream_t *stream = data_stream_of(record);
+  if (stream == NULL || stream->compression == NULL) {
+    kept_records[0] = *record;
+    return 1;
+  }
+  return data_compression_add(stream->compression, record, kept_records);
+}
+
+/**
+ * @brief Number a record and publish it directly or push it into its store.
+ *
+ * @param record record to log
+ * @return true if the record was stored
+ */
+static bool log_record(struct data_logging_record_t *record) {
+  const struct data_stream_t *stream = data_stream_of(record);
+  if (stream == NULL) {
+    ESP_LOGE(TAG, "Unknown record type: %d", record->type);
+    return false;
+  }
+  record->seq = data_store_next_sequence(stream->store);
+  if (stream->complete != NULL) {
+    stream->complete(record);
+  }
+  if (publish_record_directly(stream, record)) {
     return false;
   }
-  cJSON *data = light_data_item_to_json(&light_data_item);
+  // Unacknowledged direct records of the stream are older and are handed over
+  // first, so the stream is sent in the order of its sequence numbers.
+  hand_over_direct_records(stream);
+  return store_record(record);
+}
+
+/**
+ * @brief Log the rollups of the periods which ended.
+ *
+ * @return true if at least one record was stored
+ */
+static bool log_ended_rollups() {
+  static struct data_logging_record_t rollups[DATA_ROLLUP_NR_PERIODS];
+  const unsigned int nr_rollups =
+      data_rollup_advance(time(NULL), !data_clock_is_synced(), rollups);
+  bool is_stored = false;
+  for (unsigned int i = 0; i < nr_rollups; i++) {
+    is_stored = log_record(&rollups[i]) || is_stored;
+  }
+  return is_stored;
+}
+
+/**
+ * @brief Log the records held back by the compression for too long.
+ *
+ * The last record of a stream is held back until the next record arrives. The
+ * telemetry timer wakes the data logging task at least once per period, so no
+ * record is held back much longer than the period.
+ *
+ * @return true if at least one record was stored
+ */
+static bool release_held_records() {
+  static struct data_logging_record_t record;
+  const time_t held_before =
+      time(NULL) - CONFIG_MQTT_DATA_LOGGING_TELEMETRY_PERIOD;
+  bool is_stored = false;
+  for (unsigned int i = 0; i < DATA_LOGGING_NR_RECORD_TYPES; i++) {
+    struct data_compression_t *compression = data_streams[i].compression;
+    if (compression != NULL &&
+        data_compression_release(compression, held_before, &record)) {
+      is_stored = log_record(&record) || is_stored;
+    }
+  }
+  return is_stored;
+}
+
+/**
+ * @brief Move all records of a control task ring into the data stores.
+ *
+ * Records are published directly instead if their stream has no backlog.
+ *
+ * @param ring ring to empty
+ * @param nr_reported_dropped number of dropped records already reported
+ * @return true if at least one record was stored
+ */
+static bool store_ring_records(struct data_logging_ring_t *ring,
+                               unsigned int *nr_reported_dropped) {
+  static struct data_logging_record_t record;
+  static struct data_logging_record_t kept_records[2];
+  static struct data_logging_record_t rollups[DATA_ROLLUP_NR_PERIODS];
+  bool is_stored = false;
+  while (data_logging_ring_pop(ring, &record)) {
+    // Rollups aggregate the raw records before their compression. Cycles are
+    // stamped at their start and are already covered by the raw pump records.
+    const unsigned int nr_rollups =
+        record.type == DATA_LOGGING_RECORD_PUMP_CYCLE
+            ? 0
+            : data_rollup_add(&record, rollups);
+    for (unsigned int i = 0; i < nr_rollups; i++) {
+      is_stored = log_record(&rollups[i]) || is_stored;
+    }
+    const struct data_stream_t *stream = data_stream_of(&record);
+    if (stream != NULL && stream->is_rollup_only) {
+      continue;
+    }
+    const unsigned int nr_kept = compress_record(&record, kept_records);
+    for (unsigned int i = 0; i < nr_kept; i++) {
+      is_stored = log_record(&kept_records[i]) || is_stored;
+    }
+  }
+  const unsigned int nr_dropped = atomic_load(&ring->nr_dropped);
+  if (nr_dropped != *nr_reported_dropped) {
+    ESP_LOGW(TAG, "%u records dropped in total, the data logging is too slow",
+             nr_dropped);
+    *nr_reported_dropped = nr_dropped;
+  }
+  return is_stored;
+}
+
+/**
+ * @brief Publish the backlog of each stream and the dropped records.
+ *
+ * Published every CONFIG_MQTT_DATA_LOGGING_BACKLOG_PERIOD seconds while
+ * connected, see time_to_next_deadline.
+ */
+static void send_backlog_status() {
+  const int64_t now_us = esp_timer_get_time();
+  if (CONFIG_MQTT_DATA_LOGGING_BACKLOG_PERIOD == 0 || !is_connected_ ||
+      now_us - last_backlog_us_ <
+          (int64_t)CONFIG_MQTT_DATA_LOGGING_BACKLOG_PERIOD * 1000000) {
+    return;
+  }
+  const uint32_t interval_s = (now_us - last_backlog_us_) / 1000000;
+  last_backlog_us_ = now_us;
+
+  cJSON *data = cJSON_CreateObject();
+  cJSON_AddNumberToObject(data, "id", configuration.id);
+  cJSON_AddNumberToObject(data, "interval", interval_s);
+  cJSON_AddNumberToObject(data, "ring_dropped",
+                          atomic_load(&pump_ring_.nr_dropped) +
+                              atomic_load(&light_ring_.nr_dropped) +
+                              atomic_load(&telemetry_ring_.nr_dropped));
+  cJSON_AddNumberToObject(data, "events_dropped",
+                          atomic_load(&nr_dropped_events_));
+  cJSON *streams = cJSON_AddObjectToObject(data, "streams");
+  for (unsigned int i = 0; i < DATA_LOGGING_NR_RECORD_TYPES; i++) {
+    struct data_store_t *store = data_streams[i].store;
+    struct data_store_stats_t stats;
+    data_store_get_stats(store, &stats);
+    cJSON *stream = cJSON_AddObjectToObject(streams, store->name);
+    cJSON_AddNumberToObject(stream, "queued", stats.nr_records);
+    cJSON_AddNumberToObject(stream, "segments", stats.nr_segments);
+    cJSON_AddNumberToObject(stream, "bytes", stats.used_bytes);
+    if (stats.has_oldest) {
+      cJSON_AddNumberToObject(stream, "oldest", stats.oldest_time);
+    }
+    const unsigned int nr_sent = senders_[i].nr_sent;
+    cJSON_AddNumberToObject(stream, "sent", nr_sent);
+    // interval_s is at least 1, the period is not 0.
+    cJSON_AddNumberToObject(stream, "sent_per_h",
+                            (uint64_t)nr_sent * 3600 / interval_s);
+    cJSON_AddNumberToObject(stream, "dropped", stats.nr_dropped);
+    cJSON_AddNumberToObject(stream, "evicted", stats.nr_evicted);
+    senders_[i].nr_sent = 0;
+  }
   char *data_json_string = cJSON_PrintUnformatted(data);
   cJSON_Delete(data);
-  current_data_id_ =
-      mqtt5_sent_message(CONFIG_MQTT_LIGHT_STATUS_TOPIC, data_json_string);
+  // Lost status messages are replaced by the next one.
+  const int msg_id = mqtt5_sent_message_qos(CONFIG_MQTT_BACKLOG_STATUS_TOPIC,
+                                            data_json_string, 0);
   cJSON_free(data_json_string);
+  if (msg_id < 0) {
+    ESP_LOGW(TAG, "Failed to send the backlog status");
+  }
+}
 
-  if (current_data_id_ < 0) {
-    ESP_LOGW(TAG, "Failed to send light data");
-    light_data_store_restore_stack();
-    return false;
+/**
+ * @brief Check if published messages wait for their acknowledgement.
+ *
+ * @return true if records or chunks are in flight
+ */
+static bool is_sending() {
+  for (unsigned int i = 0; i < DATA_LOGGING_NR_RECORD_TYPES; i++) {
+    if (senders_[i].nr_in_flight > 0) {
+      return true;
+    }
   }
-  return true;
+#if CONFIG_MQTT_DATA_BULK_SHIPPING
+  if (data_shipping_is_in_flight()) {
+    return true;
+  }
+#endif
+  return nr_direct_records_ > 0;
 }
 
 /**
- * @brief Schedule the next data send operation.
+ * @brief Send all unacknowledged messages again if no acknowledgement arrived
+ * for SENT_DATA_TIMEOUT_US.
  *
- * This function checks if there is already a file in the queue. If not, it
- * retrieves the next data file path and sends the data to the MQTT broker.
+ * Checked on every wake up, so frequent records or events do not delay it.
+ *
+ * @param now_us current time
  */
-void schedule_next_data_send() {
-  if (current_data_id_ >= 0) {
-    ESP_LOGD(TAG, "Data already being sent, skipping new data");
+static void resend_if_stuck(int64_t now_us) {
+  if (!is_sending()) {
+    last_progress_us_ = now_us;
     return;
   }
-  if (schedule_next_pump_data_send()) {
-    current_data_store_ = PUMP_DATA_STORE;
-    ESP_LOGD(TAG, "Successfully scheduled next pump data send");
-  } else if (schedule_next_light_data_send()) {
-    current_data_store_ = LIGHT_DATA_STORE;
-    ESP_LOGD(TAG, "Successfully scheduled next light data send");
-  } else if (schedule_next_memory_data_send()) {
-    current_data_store_ = MEMORY_DATA_STORE;
-    ESP_LOGD(TAG, "Successfully scheduled next memory data send");
-  } else {
-    ESP_LOGI(TAG, "Not able to schedule data.");
-    current_data_store_ = UNKNOWN;
-  }
-}
-
-void restore_scheduled_data() {
-  if (current_data_id_ >= 0) {
-    switch (current_data_store_) {
-    case UNKNOWN:
-      ESP_LOGD(TAG, "Restoring unknown data store");
-      break;
-    case PUMP_DATA_STORE:
-      pump_data_store_restore_stack();
-      ESP_LOGD(TAG, "Restoring pump data store");
-      break;
-    case LIGHT_DATA_STORE:
-      light_data_store_restore_stack();
-      ESP_LOGD(TAG, "Restoring light data store");
-      break;
-    case MEMORY_DATA_STORE:
-      memory_data_store_restore_stack();
-      ESP_LOGD(TAG, "Restoring memory data store");
-      break;
-
-    default:
-      break;
-    }
+  if (now_us - last_progress_us_ < SENT_DATA_TIMEOUT_US) {
+    return;
   }
-  current_data_id_ = -1;
-  current_data_store_ = UNKNOWN;
+  // Somehow we run into a timeout during sending data. This should not
+  // happen. Just reset and try again.
+  ESP_LOGW(TAG, "No acknowledgement for %lld s, sending again",
+           (now_us - last_progress_us_) / 1000000);
+  restore_scheduled_data();
+  restore_direct_records();
+#if CONFIG_MQTT_DATA_BULK_SHIPPING
+  data_shipping_restore();
+#endif
+  last_progress_us_ = now_us;
+  schedule_next_data_send();
 }
 
 /**
- * @brief Remove the currently queued file from storage.
+ * @brief Do the storage maintenance every IDLE_PERIOD_US while nothing is
+ * sent.
+ *
+ * Checked on every wake up, so frequent records or events do not delay it.
  *
- * Happens after the data was successfully sent to the MQTT broker.
+ * @param now_us current time
+ */
+static void idle_if_due(int64_t now_us) {
+  if (is_sending() || now_us - last_idle_us_ < IDLE_PERIOD_US) {
+    return;
+  }
+  // Prepare the storage for the next writes.
+  data_store_idle();
+  last_idle_us_ = now_us;
+}
+
+/**
+ * @brief Get the time until the next deadline of the data logging task.
  *
+ * @param now_us current time
+ * @return TickType_t ticks to wait for records or events at most
  */
-void remove_queued_file_from_storage() {
-  current_data_id_ = -1;
-  current_data_store_ = UNKNOWN;
+static TickType_t time_to_next_deadline(int64_t now_us) {
+  int64_t deadline_us = is_sending() ? last_progress_us_ + SENT_DATA_TIMEOUT_US
+                                     : last_idle_us_ + IDLE_PERIOD_US;
+  if (CONFIG_MQTT_DATA_LOGGING_BACKLOG_PERIOD > 0 && is_connected_) {
+    const int64_t backlog_us =
+        last_backlog_us_ +
+        (int64_t)CONFIG_MQTT_DATA_LOGGING_BACKLOG_PERIOD * 1000000;
+    if (backlog_us < deadline_us) {
+      deadline_us = backlog_us;
+    }
+  }
+  if (deadline_us <= now_us) {
+    return 0;
+  }
+  // Round up, so the deadline has passed when the task wakes up.
+  return pdMS_TO_TICKS((deadline_us - now_us) / 1000) + 1;
 }
 
 /**
  * @brief Task to handle data logging events.
  *
- * This task waits for new data logging events and schedules sending the data
- * via mqtt.
+ * This task waits for new records of the control tasks and for data logging
+ * events and schedules sending the data via mqtt. Resending stuck messages,
+ * the storage maintenance and the backlog status run from deadlines checked on
+ * every wake up.
  *
  * @param arg
  * @return * void
  */
 void data_logging_task(void *arg) {
-  static TickType_t timeout = TIMEOUT_SENT_DATA;
   static struct data_logging_event_t event;
-  static BaseType_t queue_receive_result;
+  static unsigned int nr_reported_dropped[3] = {0};
   while (1) {
     ESP_LOGD(TAG, "Stack high water mark %d",
              uxTaskGetStackHighWaterMark(NULL));
     // Wait for new data to be added
+    ulTaskNotifyTake(pdTRUE, time_to_next_deadline(esp_timer_get_time()));
+    // Checked before new messages are sent, so the deadline of resend_if_stuck
+    // starts with the first message in flight.
+    const int64_t now_us = esp_timer_get_time();
+    resend_if_stuck(now_us);
+    idle_if_due(now_us);
 
-    queue_receive_result = xQueueReceive(event_queue_handle_, &event, timeout);
-
-    if (queue_receive_result == pdTRUE) { // Event received
-      switch (event.type) {
-      case DATA_LOGGING_EVENT_NEW_DATA:
-        ESP_LOGD(TAG, "New data event received");
-        schedule_next_data_send();
-        timeout = TIMEOUT_SENT_DATA;
-        continue;
-      case DATA_LOGGING_EVENT_CONNECTED:
-        ESP_LOGD(TAG, "Connected event received");
-        schedule_next_data_send();
-        timeout = TIMEOUT_SENT_DATA;
-        continue;
-      case DATA_LOGGING_EVENT_DISCONNECTED:
-        ESP_LOGD(TAG, "Disconnected event received");
-        restore_scheduled_data();
-        timeout = TIMEOUT_DISCONNECTED;
-        continue;
-      case DATA_LOGGING_EVENT_DATA_PUBLISHED:
-        ESP_LOGD(TAG, "Data published event received");
-        if (event.id != current_data_id_) {
-          ESP_LOGD(TAG, "Invalid data ID received");
-          timeout = TIMEOUT_SENT_DATA;
-          continue; // Skip processing if ID is invalid
-        }
-        remove_queued_file_from_storage();
-        schedule_next_data_send();
-        timeout = TIMEOUT_SENT_DATA;
-        continue;
-      default:
-        ESP_LOGE(TAG, "Unknown event type: %d", event.type);
-        timeout = TIMEOUT_SENT_DATA;
-        continue;
-      }
-    } else {
-      ESP_LOGI(TAG, "Event queue timeout");
-      // Somehow we run into a timeout during sending data. This should not
-      // happen. Just reset and try again.
-      if (current_data_id_ >= 0) {
-        restore_scheduled_data();
-        schedule_next_data_send();
-        timeout = TIMEOUT_SENT_DATA;
-        continue;
-      }
-      timeout = TIMEOUT_DISCONNECTED;
-      continue;
+    const bool is_pump_data_new =
+        store_ring_records(&pump_ring_, &nr_reported_dropped[0]);
+    const bool is_light_data_new =
+        store_ring_records(&light_ring_, &nr_reported_dropped[1]);
+    const bool is_telemetry_new =
+        store_ring_records(&telemetry_ring_, &nr_reported_dropped[2]);
+    const bool is_held_data_new = release_held_records();
+    const bool is_rollup_new = log_ended_rollups();
+    if (is_pump_data_new || is_light_data_new || is_telemetry_new ||
+        is_held_data_new || is_rollup_new) {
+      handle_event(
+          &(struct data_logging_event_t){.type = DATA_LOGGING_EVENT_NEW_DATA});
+    }
+    while (xQueueReceive(event_queue_handle_, &event, 0) == pdTRUE) {
+      handle_event(&event);
     }
+    send_backlog_status();
+  }
+}
+
+/**
+ * @brief Set the timestamp and the clock state of a record.
+ *
+ * @param record record collected now
+ */
+static void stamp_record(struct data_logging_record_t *record) {
+  record->boot_id = data_clock_boot_id();
+  record->clock_unsynced = !data_clock_is_synced();
+  time(&record->timestamp);
+}
+
+/**
+ * @brief Hand the current system telemetry to the data logging task.
+ *
+ * Called periodically by the telemetry timer.
+ *
+ * @param arg unused
+ */
+static void sample_telemetry(void *arg) {
+  struct data_logging_record_t record = {
+      .type = DATA_LOGGING_RECORD_MEMORY,
+      .memory = {.free_heap_size = esp_get_free_heap_size(),
+                 .min_free_heap_size = esp_get_minimum_free_heap_size(),
+                 .largest_free_block =
+                     heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT)},
+  };
+  int rssi;
+  if (wifi_utils_get_connection_strength(&rssi) == ESP_OK) {
+    record.memory.rssi = rssi;
   }
+  stamp_record(&record);
+  data_logging_ring_push(&telemetry_ring_, &record);
+  notify_data_logging_task();
 }
 
-void log_heap_size() {
-  size_t out_total_bytes;
-  size_t out_used_bytes;
-  esp_spiffs_info("storage", &out_total_bytes, &out_used_bytes);
+/**
+ * @brief Pump cycle saved in NVS while the pump is running.
+ *
+ */
+struct saved_pump_cycle_t {
+  int64_t timestamp;  // start of the cycle
+  uint16_t boot_id;   // boot the cycle was started in
+  uint8_t clock_unsynced;
+  uint8_t reserved;
+  uint32_t planned_s; // planned duration of the cycle
+  uint32_t actual_s;  // duration of the cycle saved last
+};
 
-  memory_data_store_push(esp_get_free_heap_size(),
-                         esp_get_minimum_free_heap_size(), out_total_bytes,
-                         out_used_bytes);
+/** @brief Running pump cycle, only accessed by the pump control task. */
+static struct saved_pump_cycle_t saved_pump_cycle_;
 
-  xQueueSendToBack(
-      event_queue_handle_,
-      &(struct data_logging_event_t){.type = DATA_LOGGING_EVENT_NEW_DATA},
-      portMAX_DELAY);
+/**
+ * @brief Write the running pump cycle to NVS or remove it.
+ *
+ * @param cycle cycle to write, NULL to remove the saved cycle
+ */
+static void write_saved_pump_cycle(const struct saved_pump_cycle_t *cycle) {
+  nvs_handle_t handle;
+  esp_err_t err = nvs_open(DATA_LOGGING_NAMESPACE, NVS_READWRITE, &handle);
+  if (err == ESP_OK) {
+    err = cycle != NULL
+              ? nvs_set_blob(handle, PUMP_CYCLE_KEY, cycle, sizeof(*cycle))
+              : nvs_erase_key(handle, PUMP_CYCLE_KEY);
+    if (err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND) {
+      err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+  }
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Can not save the pump cycle: %s", esp_err_to_name(err));
+  }
+}
+
+/**
+ * @brief Log a pump cycle which was cut short by a restart.
+ *
+ * The cycle is logged with the duration saved last, so the pump might have run
+ * a bit longer.
+ */
+static void log_interrupted_pump_cycle() {
+  nvs_handle_t handle;
+  if (nvs_open(DATA_LOGGING_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+    return;
+  }
+  struct saved_pump_cycle_t cycle;
+  size_t size = sizeof(cycle);
+  if (nvs_get_blob(handle, PUMP_CYCLE_KEY, &cycle, &size) == ESP_OK &&
+      size == sizeof(cycle)) {
+    struct data_logging_record_t record = {
+        .type = DATA_LOGGING_RECORD_PUMP_CYCLE,
+        .timestamp = cycle.timestamp,
+        .boot_id = cycle.boot_id,
+        .clock_unsynced = cycle.clock_unsynced,
+        .pump_cycle = {.planned_s = cycle.planned_s,
+                       .actual_s = cycle.actual_s,
+                       .end_reason = DATA_LOGGING_PUMP_END_REBOOT},
+    };
+    data_logging_ring_push(&pump_ring_, &record);
+    ESP_LOGI(TAG, "Pump cycle of boot %u was interrupted after %lu s",
+             cycle.boot_id, (unsigned long)cycle.actual_s);
+  }
+  nvs_erase_key(handle, PUMP_CYCLE_KEY);
+  ESP_ERROR_CHECK_WITHOUT_ABORT(nvs_commit(handle));
+  nvs_close(handle);
+}
+
+/**
+ * @brief Keep the records which are not acknowledged yet over a restart.
+ *
+ * Registered as shutdown handler.
+ */
+static void flush_on_shutdown() {
+  // Direct records exist only in RAM, store them before the stores are
+  // flushed.
+  restore_direct_records();
+  data_store_flush_all();
 }
 
 /**
@@ -338,27 +950,82 @@ void data_logging_init() {
   event_queue_handle_ =
       xQueueCreateStatic(QUEUE_LENGTH, EVENT_QUEUE_ITEM_SIZE,
                          event_queue_storage_area, &event_queue_);
-  pump_data_store_init();
-  light_data_store_init();
-  memory_data_store_init();
+  data_clock_init();
+  wifi_utils_set_time_synced_cb(set_clock_synced);
+  if (wifi_utils_is_time_synced()) {
+    // The time might have been synchronized before the callback was set.
+    set_clock_synced();
+  }
+#if CONFIG_MQTT_DATA_LOGGING_BENCHMARK
+  // Before the streams access the storage, the benchmark remounts it.
+  data_store_benchmark();
+#endif
+  data_stream_init_all();
+  // The pump control task, the only other producer of the ring, is not
+  // created yet.
+  log_interrupted_pump_cycle();
+  data_store_create_writer_task();
+  // Keep the records of the RAM buffers over a restart, e.g. after an update.
+  ESP_ERROR_CHECK_WITHOUT_ABORT(
+      esp_register_shutdown_handler(flush_on_shutdown));
+  const esp_timer_create_args_t timer_args = {
+      .callback = sample_telemetry,
+      .name = "telemetry",
+  };
+  ESP_ERROR_CHECK(esp_timer_create(&timer_args, &telemetry_timer_));
+  ESP_ERROR_CHECK(esp_timer_start_periodic(
+      telemetry_timer_,
+      (uint64_t)CONFIG_MQTT_DATA_LOGGING_TELEMETRY_PERIOD * 1000000));
 }
 
 void add_pump_data_item(bool pump_on) {
-  pump_data_store_push(pump_on);
-  xQueueSendToBack(
-      event_queue_handle_,
-      &(struct data_logging_event_t){.type = DATA_LOGGING_EVENT_NEW_DATA},
-      portMAX_DELAY);
-  log_heap_size();
+  struct data_logging_record_t record = {.type = DATA_LOGGING_RECORD_PUMP,
+                                         .pump_on = pump_on};
+  stamp_record(&record);
+  data_logging_ring_push(&pump_ring_, &record);
+  notify_data_logging_task();
+}
+
+void save_pump_cycle_start(uint32_t planned_s) {
+  struct data_logging_record_t record = {0};
+  stamp_record(&record);
+  saved_pump_cycle_ = (struct saved_pump_cycle_t){
+      .timestamp = record.timestamp,
+      .boot_id = record.boot_id,
+      .clock_unsynced = record.clock_unsynced,
+      .planned_s = planned_s,
+  };
+  write_saved_pump_cycle(&saved_pump_cycle_);
+}
+
+void save_pump_cycle_progress(uint32_t actual_s) {
+  saved_pump_cycle_.actual_s = actual_s;
+  write_saved_pump_cycle(&saved_pump_cycle_);
+}
+
+void add_pump_cycle_item(uint32_t planned_s, uint32_t actual_s,
+                         enum data_logging_pump_end end_reason) {
+  struct data_logging_record_t record = {
+      .type = DATA_LOGGING_RECORD_PUMP_CYCLE,
+      .pump_cycle = {.planned_s = planned_s,
+                     .actual_s = actual_s,
+                     .end_reason = end_reason},
+  };
+  stamp_record(&record);
+  // The duration is measured monotonically, so the start is right even if
+  // the clock was synchronized during the cycle.
+  record.timestamp -= actual_s;
+  data_logging_ring_push(&pump_ring_, &record);
+  notify_data_logging_task();
+  write_saved_pump_cycle(NULL);
 }
 
 void add_light_data_item(uint16_t intensity) {
-  light_data_store_push(intensity);
-  xQueueSendToBack(
-      event_queue_handle_,
-      &(struct data_logging_event_t){.type = DATA_LOGGING_EVENT_NEW_DATA},
-      portMAX_DELAY);
-  log_heap_size();
+  struct data_logging_record_t record = {.type = DATA_LOGGING_RECORD_LIGHT,
+                                         .intensity = intensity};
+  stamp_record(&record);
+  data_logging_ring_push(&light_ring_, &record);
+  notify_data_logging_task();
 }
 
 /**
@@ -368,12 +1035,12 @@ void add_light_data_item(uint16_t intensity) {
  */
 TaskHandle_t create_data_logging_task() {
   // Static task without dynamic memory allocation
-  TaskHandle_t task_handle = xTaskCreateStatic(
+  data_logging_task_handle_ = xTaskCreateStatic(
       data_logging_task, "DataLogging", /* Task Name */
       STACK_SIZE,           /* Number of indexes in the xStack array. */
       NULL,                 /* No Parameter */
       tskIDLE_PRIORITY + 1, /* Priority at which the task is created. */
       xStack,               /* Array to use as the task's stack. */
       &xTaskBuffer);        /* Variable to hold the task's data structure. */
-  return task_handle;
+  return data_logging_task_handle_;
 }
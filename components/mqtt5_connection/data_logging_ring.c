@@ -0,0 +1,38 @@
+#include "data_logging_ring.h"
+
+bool data_logging_ring_push(struct data_logging_ring_t *ring,
+                            const struct data_logging_record_t *record) {
+  const unsigned int head =
+      atomic_load_explicit(&ring->head, memory_order_relaxed);
+  unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  bool is_lost = false;
+  if (head - tail >= DATA_LOGGING_RING_SIZE) {
+#if CONFIG_MQTT_DATA_LOGGING_RING_OVERWRITE_OLDEST
+    // Nothing is lost if the consumer took the oldest record meanwhile.
+    is_lost = atomic_compare_exchange_strong(&ring->tail, &tail, tail + 1);
+#else
+    atomic_fetch_add(&ring->nr_dropped, 1);
+    return false;
+#endif
+  }
+  ring->records[head % DATA_LOGGING_RING_SIZE] = *record;
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  if (is_lost) {
+    atomic_fetch_add(&ring->nr_dropped, 1);
+  }
+  return !is_lost;
+}
+
+bool data_logging_ring_pop(struct data_logging_ring_t *ring,
+                           struct data_logging_record_t *record) {
+  unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  while (tail != atomic_load_explicit(&ring->head, memory_order_acquire)) {
+    *record = ring->records[tail % DATA_LOGGING_RING_SIZE];
+    // The producer advances tail before overwriting a record, so the copy is
+    // only valid if tail did not change. Otherwise retry with the new tail.
+    if (atomic_compare_exchange_strong(&ring->tail, &tail, tail + 1)) {
+      return true;
+    }
+  }
+  return false;
+}
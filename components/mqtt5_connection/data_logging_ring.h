@@ -0,0 +1,111 @@
+#ifndef COMPONENTS_MQTT5_CONNECTION_DATA_LOGGING_RING
+#define COMPONENTS_MQTT5_CONNECTION_DATA_LOGGING_RING
+/**
+ * @brief Lock free ring handing records from one control task to the data
+ * logging task.
+ *
+ * Each ring has exactly one producer and the data logging task as the only
+ * consumer. Neither side ever blocks. If the ring is full, the new record is
+ * dropped or the oldest record is overwritten, depending on the configured
+ * policy. Both cases are counted.
+ *
+ */
+
+#include "sdkconfig.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/** @brief Number of records in one ring. */
+#define DATA_LOGGING_RING_SIZE CONFIG_MQTT_DATA_LOGGING_RING_SIZE
+
+_Static_assert((DATA_LOGGING_RING_SIZE & (DATA_LOGGING_RING_SIZE - 1)) == 0,
+               "The ring size must be a power of two");
+
+/**
+ * @brief Type of a record in the ring.
+ *
+ */
+enum data_logging_record_type {
+  DATA_LOGGING_RECORD_PUMP = 0,
+  DATA_LOGGING_RECORD_LIGHT = 1,
+  DATA_LOGGING_RECORD_MEMORY = 2,
+  DATA_LOGGING_RECORD_ROLLUP = 3,
+  DATA_LOGGING_RECORD_PUMP_CYCLE = 4,
+  DATA_LOGGING_NR_RECORD_TYPES,
+};
+
+/**
+ * @brief Record handed from a control task to the data logging task.
+ *
+ */
+struct data_logging_record_t {
+  enum data_logging_record_type type;
+  time_t timestamp;    // timestamp when the data was collected
+  uint32_t seq;        // sequence number, set by the data logging task
+  uint16_t boot_id;    // boot the data was collected in
+  bool clock_unsynced; // true if collected before the time synchronization
+  union {
+    bool pump_on;       // DATA_LOGGING_RECORD_PUMP
+    uint16_t intensity; // DATA_LOGGING_RECORD_LIGHT
+    struct {
+      uint32_t free_heap_size;
+      uint32_t min_free_heap_size;
+      uint32_t largest_free_block;
+      uint32_t store_used_bytes; // set by the data logging task
+      int8_t rssi;               // 0 if not connected to the wifi
+    } memory; // DATA_LOGGING_RECORD_MEMORY
+    struct {
+      uint32_t seconds;            // seconds of the period covered
+      uint32_t pump_on_s;          // seconds the pump was on
+      uint32_t light_dose;         // intensity integrated over the seconds
+      uint32_t min_free_heap_size; // smallest sampled free heap, 0 if none
+      uint32_t max_free_heap_size; // largest sampled free heap, 0 if none
+      uint16_t pump_cycles;        // number of times the pump was switched on
+      uint8_t period;              // enum data_rollup_period
+    } rollup; // DATA_LOGGING_RECORD_ROLLUP, only created by the logging task
+    struct {
+      uint32_t planned_s; // planned duration of the cycle
+      uint32_t actual_s;  // measured duration of the cycle
+      uint8_t end_reason; // enum data_logging_pump_end
+    } pump_cycle; // DATA_LOGGING_RECORD_PUMP_CYCLE, stamped at start
+  };
+};
+
+/**
+ * @brief Single producer single consumer ring.
+ *
+ * head and tail are free running counters. Only the producer writes head.
+ * The consumer advances tail, the producer only if it overwrites the oldest
+ * record.
+ *
+ */
+struct data_logging_ring_t {
+  struct data_logging_record_t records[DATA_LOGGING_RING_SIZE];
+  atomic_uint head;
+  atomic_uint tail;
+  atomic_uint nr_dropped; // records lost because the ring was full
+};
+
+/**
+ * @brief Add a record to the ring. Only called by the producer.
+ *
+ * @param ring ring to add to
+ * @param record record to add
+ * @return true if no record was lost
+ */
+bool data_logging_ring_push(struct data_logging_ring_t *ring,
+                            const struct data_logging_record_t *record);
+
+/**
+ * @brief Remove the oldest record from the ring. Only called by the consumer.
+ *
+ * @param ring ring to remove from
+ * @param record output for the record
+ * @return true if a record was removed, false if the ring is empty
+ */
+bool data_logging_ring_pop(struct data_logging_ring_t *ring,
+                           struct data_logging_record_t *record);
+
+#endif /* COMPONENTS_MQTT5_CONNECTION_DATA_LOGGING_RING */
@@ -0,0 +1,164 @@
+#include "data_query.h"
+
+#include "configuration.h"
+#include "data_logging.h"
+#include "data_stream.h"
+#include "mqtt5_connection.h"
+
+#include "cJSON.h"
+#include "esp_log.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static const char *TAG = "data_query";
+
+/** @brief Maximum length of the response topic including termination. */
+#define MAX_RESPONSE_TOPIC_LENGTH 64
+/** @brief Maximum length of the correlation data. */
+#define MAX_CORRELATION_DATA_LENGTH 32
+
+/**
+ * @brief Received query waiting for the data logging task.
+ *
+ */
+struct data_query_t {
+  const struct data_stream_t *stream; // stream to query
+  time_t from;                        // start of the time window
+  time_t to;                          // end of the time window
+  bool has_after_seq;                 // true to continue a previous query
+  uint32_t after_seq;                 // last record of the previous query
+  char response_topic[MAX_RESPONSE_TOPIC_LENGTH];
+  uint8_t correlation_data[MAX_CORRELATION_DATA_LENGTH];
+  int correlation_data_len;
+};
+
+static struct data_query_t query_;
+/** @brief Set while query_ is owned by the data logging task. */
+static atomic_bool is_query_pending_ = false;
+
+/**
+ * @brief property for subscribing to the data query channel
+ *
+ */
+static esp_mqtt5_subscribe_property_config_t data_query_subscribe_property = {
+    .subscribe_id = 2,
+    .no_local_flag = false,
+    .retain_as_published_flag = false,
+    .retain_handle = 0,
+    .is_share_subscribe = false,
+    .share_name = NULL,
+};
+
+void subscribe_to_data_query_channel(esp_mqtt_client_handle_t client) {
+  esp_mqtt5_client_set_user_property(
+      &data_query_subscribe_property.user_property, user_property_arr,
+      USE_PROPERTY_ARR_SIZE);
+  esp_mqtt5_client_set_subscribe_property(client,
+                                          &data_query_subscribe_property);
+  int msg_id = esp_mqtt_client_subscribe(client, CONFIG_MQTT_DATA_QUERY_TOPIC,
+                                         0);
+  esp_mqtt5_client_delete_user_property(
+      data_query_subscribe_property.user_property);
+  data_query_subscribe_property.user_property = NULL;
+  ESP_LOGD(TAG, "Subscribed to data query channel, msg_id=%d", msg_id);
+}
+
+/**
+ * @brief Parse a data query from json.
+ *
+ * @param json json string of the query
+ * @param json_length length of the json string
+ * @param query output for the parsed query
+ * @return true if the query is valid
+ */
+static bool parse_data_query(const char *json, const size_t json_length,
+                             struct data_query_t *query) {
+  cJSON *root = cJSON_ParseWithLength(json, json_length);
+  if (root == NULL) {
+    ESP_LOGI(TAG, "Can not parse data query json");
+    return false;
+  }
+
+  const cJSON *id = cJSON_GetObjectItem(root, "id");
+  const cJSON *stream = cJSON_GetObjectItem(root, "stream");
+  const cJSON *from = cJSON_GetObjectItem(root, "from");
+  const cJSON *to = cJSON_GetObjectItem(root, "to");
+  const cJSON *after_seq = cJSON_GetObjectItem(root, "after_seq");
+  query->stream = NULL;
+  if ((id == NULL || id->valueint == configuration.id) &&
+      cJSON_IsString(stream) && cJSON_IsNumber(from)) {
+    query->stream = data_stream_find(stream->valuestring);
+    query->from = (time_t)from->valuedouble;
+    query->to = cJSON_IsNumber(to) ? (time_t)to->valuedouble : time(NULL);
+    query->has_after_seq = cJSON_IsNumber(after_seq);
+    query->after_seq =
+        query->has_after_seq ? (uint32_t)after_seq->valuedouble : 0;
+  }
+  cJSON_Delete(root);
+  return query->stream != NULL;
+}
+
+void new_data_query_received_cb(esp_mqtt_event_handle_t event) {
+  ESP_LOGI(TAG, "New data query received");
+  if (atomic_load(&is_query_pending_)) {
+    ESP_LOGW(TAG, "Data query dropped, the previous one is not answered yet");
+    return;
+  }
+  if (!parse_data_query(event->data, event->data_len, &query_)) {
+    ESP_LOGW(TAG, "Invalid data query");
+    return;
+  }
+
+  const esp_mqtt5_event_property_t *property = event->property;
+  if (property->response_topic_len > 0 &&
+      property->response_topic_len < MAX_RESPONSE_TOPIC_LENGTH) {
+    memcpy(query_.response_topic, property->response_topic,
+           property->response_topic_len);
+    query_.response_topic[property->response_topic_len] = '\0';
+  } else {
+    snprintf(query_.response_topic, sizeof(query_.response_topic), "%s",
+             CONFIG_MQTT_DATA_QUERY_RESPONSE_TOPIC);
+  }
+  query_.correlation_data_len = 0;
+  if (property->correlation_data_len <= MAX_CORRELATION_DATA_LENGTH) {
+    memcpy(query_.correlation_data, property->correlation_data,
+           property->correlation_data_len);
+    query_.correlation_data_len = property->correlation_data_len;
+  }
+
+  atomic_store(&is_query_pending_, true);
+  set_data_query_received();
+}
+
+void answer_data_query() {
+  if (!atomic_load(&is_query_pending_)) {
+    return;
+  }
+  cJSON *response = cJSON_CreateObject();
+  cJSON_AddNumberToObject(response, "id", configuration.id);
+  cJSON_AddStringToObject(response, "stream", query_.stream->store->name);
+  cJSON *records = cJSON_AddArrayToObject(response, "records");
+  uint32_t last_seq = query_.after_seq;
+  const bool is_complete = data_stream_query(
+      query_.stream, query_.from, query_.to,
+      query_.has_after_seq ? &query_.after_seq : NULL,
+      CONFIG_MQTT_DATA_QUERY_MAX_RECORDS, records, &last_seq);
+  cJSON_AddBoolToObject(response, "complete", is_complete);
+  if (!is_complete) {
+    cJSON_AddNumberToObject(response, "last_seq", last_seq);
+  }
+  char *response_string = cJSON_PrintUnformatted(response);
+  cJSON_Delete(response);
+
+  const int msg_id = mqtt5_sent_response(
+      query_.response_topic, response_string,
+      (const char *)query_.correlation_data, query_.correlation_data_len);
+  cJSON_free(response_string);
+  if (msg_id < 0) {
+    ESP_LOGW(TAG, "Failed to send data query response");
+  }
+  ESP_LOGD(TAG, "Answered data query, msg_id=%d", msg_id);
+  atomic_store(&is_query_pending_, false);
+}
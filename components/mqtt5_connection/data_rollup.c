@@ -0,0 +1,194 @@
+#include "data_rollup.h"
+
+#include "data_clock.h"
+
+/**
+ * @brief Aggregates of one period.
+ *
+ */
+struct data_rollup_state_t {
+  bool is_started;     // false until the first record arrived
+  bool clock_unsynced; // true if the period uses the unsynchronized clock
+  time_t start;        // start of the period
+  time_t end;          // end of the period, exclusive
+  time_t until;        // time up to which the aggregates are updated
+  time_t first;        // time of the first aggregated second
+  uint32_t pump_on_s;
+  uint64_t light_dose;
+  uint32_t min_free_heap_size;
+  uint32_t max_free_heap_size;
+  uint16_t pump_cycles;
+};
+
+/** @brief Aggregates of the current hour and day. */
+static struct data_rollup_state_t periods_[DATA_ROLLUP_NR_PERIODS];
+/** @brief True while the pump is on. */
+static bool is_pump_on_ = false;
+/** @brief Current light intensity. */
+static uint16_t intensity_ = 0;
+
+/**
+ * @brief Start a period at the beginning of the local hour or day of a time.
+ *
+ * @param period period to start
+ * @param type type of the period
+ * @param now time within the period
+ * @param is_clock_unsynced true if the time is not synchronized yet
+ */
+static void start_period(struct data_rollup_state_t *period,
+                         enum data_rollup_period type, time_t now,
+                         bool is_clock_unsynced) {
+  struct tm timeinfo;
+  localtime_r(&now, &timeinfo);
+  timeinfo.tm_min = 0;
+  timeinfo.tm_sec = 0;
+  if (type == DATA_ROLLUP_DAY) {
+    timeinfo.tm_hour = 0;
+  }
+  timeinfo.tm_isdst = -1;
+  const time_t start = mktime(&timeinfo);
+  // Days around a daylight saving time change are shorter or longer.
+  if (type == DATA_ROLLUP_DAY) {
+    timeinfo.tm_mday++;
+  } else {
+    timeinfo.tm_hour++;
+  }
+  timeinfo.tm_isdst = -1;
+  *period = (struct data_rollup_state_t){
+      .is_started = true,
+      .clock_unsynced = is_clock_unsynced,
+      .start = start,
+      .end = mktime(&timeinfo),
+      .until = now,
+      .first = now,
+  };
+}
+
+/**
+ * @brief Update the aggregates of a period up to a time.
+ *
+ * The pump state and the intensity did not change since the last update.
+ *
+ * @param period period to update
+ * @param until time to update to
+ */
+static void accumulate(struct data_rollup_state_t *period, time_t until) {
+  if (until <= period->until) {
+    return;
+  }
+  const uint32_t seconds = until - period->until;
+  if (is_pump_on_) {
+    period->pump_on_s += seconds;
+  }
+  period->light_dose += (uint64_t)intensity_ * seconds;
+  period->until = until;
+}
+
+/**
+ * @brief Create the rollup record of a period.
+ *
+ * The record is stamped with the end of the covered time. So it is never older
+ * than the rollups emitted before, also if an hour and a day end together.
+ *
+ * @param period ended period
+ * @param type type of the period
+ * @param out output for the record
+ */
+static void emit_period(const struct data_rollup_state_t *period,
+                        enum data_rollup_period type,
+                        struct data_logging_record_t *out) {
+  *out = (struct data_logging_record_t){
+      .type = DATA_LOGGING_RECORD_ROLLUP,
+      .timestamp = period->until,
+      .boot_id = data_clock_boot_id(),
+      .clock_unsynced = period->clock_unsynced,
+      .rollup =
+          {
+              .seconds = period->until - period->first,
+              .pump_on_s = period->pump_on_s,
+              .light_dose = period->light_dose > UINT32_MAX
+                                ? UINT32_MAX
+                                : (uint32_t)period->light_dose,
+              .min_free_heap_size = period->min_free_heap_size,
+              .max_free_heap_size = period->max_free_heap_size,
+              .pump_cycles = period->pump_cycles,
+              .period = type,
+          },
+  };
+}
+
+unsigned int data_rollup_advance(time_t now, bool is_clock_unsynced,
+                                 struct data_logging_record_t *out) {
+  unsigned int nr_out = 0;
+  for (unsigned int i = 0; i < DATA_ROLLUP_NR_PERIODS; i++) {
+    struct data_rollup_state_t *period = &periods_[i];
+    if (!period->is_started) {
+      start_period(period, i, now, is_clock_unsynced);
+      continue;
+    }
+    if (period->clock_unsynced != is_clock_unsynced) {
+      // The time jumped with the synchronization, end the period early.
+      emit_period(period, i, &out[nr_out++]);
+      start_period(period, i, now, is_clock_unsynced);
+      continue;
+    }
+    if (now < period->end) {
+      continue;
+    }
+    accumulate(period, period->end);
+    emit_period(period, i, &out[nr_out++]);
+    const time_t end = period->end;
+    start_period(period, i, now, is_clock_unsynced);
+    if (period->start == end) {
+      // No gap, the following period covers the time up to now.
+      period->first = end;
+      period->until = end;
+      accumulate(period, now);
+    }
+  }
+  return nr_out;
+}
+
+unsigned int data_rollup_add(const struct data_logging_record_t *record,
+                             struct data_logging_record_t *out) {
+  const unsigned int nr_out =
+      data_rollup_advance(record->timestamp, record->clock_unsynced, out);
+  for (unsigned int i = 0; i < DATA_ROLLUP_NR_PERIODS; i++) {
+    struct data_rollup_state_t *period = &periods_[i];
+    accumulate(period, record->timestamp);
+    switch (record->type) {
+    case DATA_LOGGING_RECORD_PUMP:
+      if (record->pump_on && !is_pump_on_) {
+        period->pump_cycles++;
+      }
+      break;
+    case DATA_LOGGING_RECORD_MEMORY:
+      if (period->max_free_heap_size == 0 ||
+          record->memory.free_heap_size < period->min_free_heap_size) {
+        period->min_free_heap_size = record->memory.free_heap_size;
+      }
+      if (record->memory.free_heap_size > period->max_free_heap_size) {
+        period->max_free_heap_size = record->memory.free_heap_size;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+  // The new state applies from the record on.
+  if (record->type == DATA_LOGGING_RECORD_PUMP) {
+    is_pump_on_ = record->pump_on;
+  } else if (record->type == DATA_LOGGING_RECORD_LIGHT) {
+    intensity_ = record->intensity;
+  }
+  return nr_out;
+}
+
+const char *data_rollup_period_name(enum data_rollup_period period) {
+  switch (period) {
+  case DATA_ROLLUP_HOUR:
+    return "hour";
+  default:
+    return "day";
+  }
+}
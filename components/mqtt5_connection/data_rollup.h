@@ -0,0 +1,64 @@
+#ifndef COMPONENTS_MQTT5_CONNECTION_DATA_ROLLUP
+#define COMPONENTS_MQTT5_CONNECTION_DATA_ROLLUP
+/**
+ * @brief Hourly and daily aggregates of the pump, light and memory records.
+ *
+ * The aggregates are updated incrementally with each raw record and are
+ * emitted as rollup records once their period ended, stamped with the end of
+ * the covered time. The periods follow the local time. The aggregates are kept
+ * in RAM only, so the first period after a boot and the periods around the
+ * time synchronization only cover a part of the period, see the seconds of the
+ * rollup record.
+ *
+ * Only used by the data logging task.
+ *
+ */
+
+#include "data_logging_ring.h"
+
+/**
+ * @brief Period of a rollup record.
+ *
+ */
+enum data_rollup_period {
+  DATA_ROLLUP_HOUR = 0,
+  DATA_ROLLUP_DAY = 1,
+  DATA_ROLLUP_NR_PERIODS,
+};
+
+/**
+ * @brief Aggregate a raw record.
+ *
+ * Periods which ended before the record are emitted first.
+ *
+ * @param record pump, light or memory record
+ * @param out output for the ended periods, space for DATA_ROLLUP_NR_PERIODS
+ * records
+ * @return unsigned int number of emitted rollup records
+ */
+unsigned int data_rollup_add(const struct data_logging_record_t *record,
+                             struct data_logging_record_t *out);
+
+/**
+ * @brief Emit the periods which ended before now.
+ *
+ * Called periodically, so a period is emitted even if no records arrive.
+ *
+ * @param now current time
+ * @param is_clock_unsynced true if the time is not synchronized yet
+ * @param out output for the ended periods, space for DATA_ROLLUP_NR_PERIODS
+ * records
+ * @return unsigned int number of emitted rollup records
+ */
+unsigned int data_rollup_advance(time_t now, bool is_clock_unsynced,
+                                 struct data_logging_record_t *out);
+
+/**
+ * @brief Get the name of a period used in the published records.
+ *
+ * @param period period of a rollup record
+ * @return const char* name of the period
+ */
+const char *data_rollup_period_name(enum data_rollup_period period);
+
+#endif /* COMPONENTS_MQTT5_CONNECTION_DATA_ROLLUP */
@@ -0,0 +1,82 @@
+#include "data_shipping.h"
+
+#include "data_store.h"
+#include "mqtt5_connection.h"
+
+#include "esp_log.h"
+
+static const char *TAG = "data_shipping";
+
+/** @brief Bytes of a publish packet besides topic and payload. */
+#define PUBLISH_OVERHEAD 64
+/** @brief Maximum size of one chunk including its header. */
+#define CHUNK_SIZE                                                             \
+  (CONFIG_MQTT_DATA_BULK_MAX_PACKET_SIZE - PUBLISH_OVERHEAD -                  \
+   (sizeof(CONFIG_MQTT_DATA_BULK_TOPIC) - 1))
+
+_Static_assert(CHUNK_SIZE > sizeof(struct data_store_chunk_header_t),
+               "The bulk packet size is too small for a chunk");
+
+/** @brief Buffer of the chunk being published. */
+static uint8_t chunk_buffer_[CHUNK_SIZE];
+/** @brief Last published chunk. */
+static struct data_store_chunk_t chunk_;
+/** @brief Message ids of the chunks waiting for their acknowledgement. */
+static int in_flight_[CONFIG_MQTT_DATA_BULK_WINDOW];
+/** @brief Number of chunks waiting for their acknowledgement. */
+static unsigned int nr_in_flight_ = 0;
+
+/**
+ * @brief Check if all chunks of the current segment are published.
+ *
+ * @return true if the last chunk of the segment was published
+ */
+static inline bool is_segment_published() { return chunk_.is_last; }
+
+bool data_shipping_schedule() {
+  while (!is_segment_published() &&
+         nr_in_flight_ < CONFIG_MQTT_DATA_BULK_WINDOW) {
+    struct data_store_chunk_t chunk = chunk_;
+    const size_t size =
+        data_store_read_chunk(&chunk, chunk_buffer_, sizeof(chunk_buffer_));
+    if (size == 0) {
+      break;
+    }
+    const int msg_id = mqtt5_sent_binary(CONFIG_MQTT_DATA_BULK_TOPIC,
+                                         chunk_buffer_, size);
+    if (msg_id < 0) {
+      ESP_LOGW(TAG, "Failed to ship chunk of stream %u", chunk.stream_id);
+      break;
+    }
+    ESP_LOGD(TAG, "Shipped %u bytes of stream %u at offset %u, msg_id=%d",
+             chunk.size, chunk.stream_id, chunk.offset, msg_id);
+    chunk_ = chunk;
+    in_flight_[nr_in_flight_++] = msg_id;
+  }
+  return nr_in_flight_ > 0;
+}
+
+bool data_shipping_published(int id) {
+  for (unsigned int i = 0; i < nr_in_flight_; i++) {
+    if (in_flight_[i] != id) {
+      continue;
+    }
+    in_flight_[i] = in_flight_[--nr_in_flight_];
+    if (nr_in_flight_ == 0 && is_segment_published()) {
+      data_store_remove_segment(&chunk_);
+      // Start with the oldest segment of the same stream next.
+      chunk_ = (struct data_store_chunk_t){.stream_id = chunk_.stream_id};
+    }
+    return true;
+  }
+  return false;
+}
+
+bool data_shipping_is_in_flight() { return nr_in_flight_ > 0; }
+
+bool data_shipping_restore() {
+  const bool is_in_flight = nr_in_flight_ > 0;
+  nr_in_flight_ = 0;
+  chunk_ = (struct data_store_chunk_t){.stream_id = chunk_.stream_id};
+  return is_in_flight;
+}
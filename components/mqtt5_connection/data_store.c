@@ -0,0 +1,1131 @@
+#include "data_store.h"
+#include "configuration.h"
+#include "data_clock.h"
+#include "data_store_backend.h"
+#include "data_store_codec.h"
+#include "data_store_index.h"
+
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+static const char *TAG = "data_store";
+
+/** @brief Maximum number of stores, including the benchmark store. */
+#define MAX_STORES (DATA_STORE_NR_STREAMS + 1)
+/** @brief NVS namespace holding the reserved sequence numbers. */
+#define SEQUENCE_NAMESPACE "data_store"
+/** @brief Time to wait before retrying a failed write. */
+#define WRITER_RETRY_TIMEOUT 10 * 1000 / portTICK_PERIOD_MS // 10 s
+/** @brief Time a full RAM buffer waits to be drained before it is written. */
+#define SPILL_DELAY pdMS_TO_TICKS(CONFIG_MQTT_DATA_LOGGING_SPILL_DELAY * 1000)
+
+/* Dimensions of the buffer that the task being created will use as its stack.
+   NOTE: This is the number of words the stack will hold, not the number of
+   bytes. For example, if each stack item is 32-bits, and this is set to 100,
+   then 400 bytes (100 * 32-bits) will be allocated. */
+#define STACK_SIZE 3072
+
+/* Structure that will hold the TCB of the task being created. */
+static StaticTask_t xTaskBuffer;
+
+/* Buffer that the task being created will use as its stack. Note this is
+   an array of StackType_t variables. The size of StackType_t is dependent on
+   the RTOS port. */
+static StackType_t xStack[STACK_SIZE];
+
+static TaskHandle_t writer_task_handle_ = NULL;
+static struct data_store_t *stores_[MAX_STORES] = {NULL};
+static unsigned int nr_stores_ = 0;
+
+/**
+ * @brief Update the crc of the RTC tail buffer after a change.
+ *
+ * @param tail tail buffer to update
+ */
+static inline void
+data_store_rtc_tail_seal_(struct data_store_rtc_tail_t *tail) {
+  tail->crc = esp_rom_crc32_le(0, (const uint8_t *)tail + sizeof(tail->crc),
+                               sizeof(*tail) - sizeof(tail->crc));
+}
+
+/**
+ * @brief Add a record to the RTC tail buffer, replacing the oldest one if full.
+ *
+ * Needs to be called with the mutex taken.
+ *
+ * @param store store owning the tail buffer
+ * @param item record to add
+ */
+static void data_store_rtc_tail_append_(struct data_store_t *store,
+                                        const void *item) {
+  struct data_store_rtc_tail_t *tail = store->rtc_tail;
+  if (store->rtc_capacity == 0) {
+    return;
+  }
+  memcpy(tail->items + tail->head * store->item_size, item, store->item_size);
+  tail->head = (tail->head + 1) % store->rtc_capacity;
+  if (tail->count < store->rtc_capacity) {
+    tail->count++;
+  }
+  data_store_rtc_tail_seal_(tail);
+}
+
+/**
+ * @brief Drop the records from the RTC tail buffer which left the RAM buffers.
+ *
+ * The records in the RAM buffers are always the newest ones, so the tail only
+ * keeps as many records as the RAM buffers hold. Needs to be called with the
+ * mutex taken.
+ *
+ * @param store store owning the tail buffer
+ */
+static void data_store_rtc_tail_trim_(struct data_store_t *store) {
+  unsigned int nr_ram_records = store->buffers[store->active].count;
+  if (store->is_pending) {
+    nr_ram_records += store->buffers[store->active ^ 1].count;
+  }
+  if (store->rtc_tail->count > nr_ram_records) {
+    store->rtc_tail->count = nr_ram_records;
+    data_store_rtc_tail_seal_(store->rtc_tail);
+  }
+}
+
+/**
+ * @brief Push the records left in the RTC tail buffer by a soft reset again.
+ *
+ * After power on the RTC memory is random and the crc does not match.
+ *
+ * @param store store owning the tail buffer
+ */
+static void data_store_rtc_tail_restore_(struct data_store_t *store) {
+  struct data_store_rtc_tail_t *tail = store->rtc_tail;
+  const uint32_t crc =
+      esp_rom_crc32_le(0, (const uint8_t *)tail + sizeof(tail->crc),
+                       sizeof(*tail) - sizeof(tail->crc));
+  if (crc != tail->crc || tail->stream_id != store->stream_id ||
+      tail->nr_fields != store->nr_fields ||
+      tail->item_size != store->item_size ||
+      tail->head >= store->rtc_capacity || tail->count > store->rtc_capacity) {
+    memset(tail, 0, sizeof(*tail));
+    tail->stream_id = store->stream_id;
+    tail->nr_fields = store->nr_fields;
+    tail->item_size = store->item_size;
+    data_store_rtc_tail_seal_(tail);
+    return;
+  }
+  const unsigned int count = tail->count;
+  const unsigned int first =
+      (tail->head + store->rtc_capacity - count) % store->rtc_capacity;
+  tail->count = 0;
+  data_store_rtc_tail_seal_(tail);
+  // The pushes append behind head and never reach the records not yet read.
+  for (unsigned int i = 0; i < count; i++) {
+    data_store_push(store, tail->items + ((first + i) % store->rtc_capacity) *
+                                             store->item_size);
+  }
+  if (count > 0) {
+    ESP_LOGI(TAG, "%s restored %u records from RTC memory", store->name, count);
+  }
+}
+
+/**
+ * @brief Evict the oldest segments until a new segment fits.
+ *
+ * The segment needs to fit into the quota of the stream and into the free
+ * space of the storage. Needs to be called with the storage mutex taken.
+ *
+ * @param store store to write to
+ * @param max_size upper bound of the size of the new segment in bytes
+ */
+static void data_store_make_space_(struct data_store_t *store,
+                                   size_t max_size) {
+  unsigned int nr_evicted = 0;
+  while (data_store_backend_nr_segments(store) > 0 &&
+         (store->used_bytes + max_size > store->quota ||
+          !data_store_backend_has_space(store, max_size))) {
+    data_store_reset_replay(store);
+    data_store_backend_remove_oldest(store);
+    nr_evicted++;
+  }
+  if (nr_evicted > 0) {
+    store->nr_evicted += nr_evicted;
+    ESP_LOGW(TAG, "%s evicted %u oldest segments, %u bytes used", store->name,
+             nr_evicted, store->used_bytes);
+  }
+}
+
+/**
+ * @brief Write records as a new segment to the storage.
+ *
+ * The records are encoded from the oldest to the newest one. Needs to be
+ * called with the storage mutex taken.
+ *
+ * @param store store to write
+ * @param nr_records number of records
+ * @param min_time timestamp of the oldest record
+ * @param max_time timestamp of the newest record
+ * @param read_record reads the fields of the record with an index
+ * @param source records passed to read_record
+ * @return true if the segment was written
+ */
+static bool data_store_write_segment_(
+    struct data_store_t *store, unsigned int nr_records, int64_t min_time,
+    int64_t max_time,
+    void (*read_record)(struct data_store_t *store, const void *source,
+                        unsigned int index, uint64_t *values),
+    const void *source) {
+  struct data_store_segment_header_t header = {
+      .stream_id = store->stream_id,
+      .nr_records = nr_records,
+      .min_time = min_time,
+      .max_time = max_time,
+  };
+  data_store_seal_segment_header(&header);
+  // Only the first record may exceed the bound of the encoded size.
+  const size_t max_size = sizeof(header) + DATA_STORE_MAX_ENCODED_RECORD_SIZE +
+                          nr_records * data_store_max_encoded_size(store);
+  data_store_make_space_(store, max_size);
+  if (!data_store_backend_begin_segment(store, max_size)) {
+    return false;
+  }
+  const uint32_t location = data_store_backend_head_segment(store);
+  bool is_written = true;
+  memcpy(store->encode_buffer, &header, sizeof(header));
+  size_t size = sizeof(header);
+  uint64_t values[2][DATA_STORE_MAX_FIELDS];
+  for (unsigned int i = 0; i < nr_records && is_written; i++) {
+    if (size + DATA_STORE_MAX_ENCODED_RECORD_SIZE >
+        sizeof(store->encode_buffer)) {
+      is_written = data_store_backend_append(store, store->encode_buffer, size);
+      size = 0;
+    }
+    read_record(store, source, i, values[i % 2]);
+    size += data_store_encode_record(store, values[i % 2],
+                                     i > 0 ? values[(i + 1) % 2] : NULL,
+                                     store->encode_buffer + size);
+  }
+  if (is_written && size > 0) {
+    is_written = data_store_backend_append(store, store->encode_buffer, size);
+  }
+  if (!data_store_backend_end_segment(store, is_written)) {
+    return false;
+  }
+  data_store_index_add(store, &(struct data_store_index_entry_t){
+                                  .min_time = header.min_time,
+                                  .max_time = header.max_time,
+                                  .location = location,
+                              });
+  return true;
+}
+
+/**
+ * @brief Read the fields of a record of a RAM buffer.
+ *
+ * @param store store owning the buffer
+ * @param source buffer to read from
+ * @param index index of the record, 0 is the oldest one
+ * @param values output for the field values
+ */
+static void data_store_read_buffer_record_(struct data_store_t *store,
+                                           const void *source,
+                                           unsigned int index,
+                                           uint64_t *values) {
+  const struct data_store_buffer_t *buffer = source;
+  const unsigned int pos = (buffer->tail + index) % store->capacity;
+  data_store_unpack_record(store, buffer->items + pos * store->packed_size,
+                           buffer, values);
+}
+
+/**
+ * @brief Write all records of a RAM buffer as a new segment to the storage.
+ *
+ * Needs to be called with the storage mutex taken.
+ *
+ * @param store store to write
+ * @param buffer buffer to write
+ * @return true if the segment was written
+ */
+static bool
+data_store_write_to_disc_(struct data_store_t *store,
+                          const struct data_store_buffer_t *buffer) {
+  return data_store_write_segment_(store, buffer->count, buffer->time_base,
+                                   buffer->max_time,
+                                   data_store_read_buffer_record_, buffer);
+}
+
+/**
+ * @brief Write the buffer waiting for the writer task to the storage.
+ *
+ * Needs to be called with the storage mutex taken. The records of the pending
+ * buffer are only removed by the pop with the storage mutex taken, so the
+ * buffer can be written without holding the mutex.
+ *
+ * @param store store to write
+ * @return true if no buffer is waiting anymore
+ */
+static bool data_store_write_pending_(struct data_store_t *store) {
+  if (xSemaphoreTake(store->mutex, portMAX_DELAY) != pdTRUE) {
+    return false;
+  }
+  const bool is_pending = store->is_pending;
+  struct data_store_buffer_t *buffer = &store->buffers[store->active ^ 1];
+  xSemaphoreGive(store->mutex);
+  if (!is_pending) {
+    return true;
+  }
+  if (buffer->count > 0 && !data_store_write_to_disc_(store, buffer)) {
+    return false;
+  }
+  if (xSemaphoreTake(store->mutex, portMAX_DELAY) != pdTRUE) {
+    return false;
+  }
+  buffer->head = 0;
+  buffer->tail = 0;
+  buffer->count = 0;
+  store->is_pending = false;
+  data_store_rtc_tail_trim_(store);
+  xSemaphoreGive(store->mutex);
+  return true;
+}
+
+/**
+ * @brief Hand the active buffer to the writer task.
+ *
+ * Needs to be called with the mutex taken and no buffer pending.
+ *
+ * @param store store to swap
+ */
+static inline void data_store_swap_buffers_(struct data_store_t *store) {
+  store->is_pending = true;
+  store->pending_since = xTaskGetTickCount();
+  store->active ^= 1;
+  struct data_store_buffer_t *buffer = &store->buffers[store->active];
+  buffer->head = 0;
+  buffer->tail = 0;
+  buffer->count = 0;
+}
+
+/**
+ * @brief Pop the oldest record of a RAM buffer.
+ *
+ * Needs to be called with the mutex taken.
+ *
+ * @param store store to pop from
+ * @param buffer buffer to pop from
+ * @param item output for the record
+ * @return true if a record was popped
+ */
+static bool data_store_pop_buffer_(struct data_store_t *store,
+                                   struct data_store_buffer_t *buffer,
+                                   void *item) {
+  if (buffer->count == 0) {
+    return false;
+  }
+  uint64_t values[DATA_STORE_MAX_FIELDS];
+  data_store_unpack_record(store,
+                           buffer->items + buffer->tail * store->packed_size,
+                           buffer, values);
+  data_store_write_fields(store, values, item);
+  buffer->tail = (buffer->tail + 1) % store->capacity;
+  buffer->count--;
+  if (store->is_pending && buffer->count == 0 &&
+      buffer == &store->buffers[store->active ^ 1]) {
+    // Drained before the writer task spilled it to the storage.
+    buffer->head = 0;
+    buffer->tail = 0;
+    store->is_pending = false;
+  }
+  data_store_rtc_tail_trim_(store);
+  return true;
+}
+
+/**
+ * @brief Get the time until the pending buffer of a store is spilled.
+ *
+ * The pending buffer is spilled to the storage if it was not drained within
+ * SPILL_DELAY or if the active buffer is half full, so records are not dropped
+ * while the pending buffer is written. Needs to be called with the mutex taken.
+ *
+ * @param store store to check
+ * @return TickType_t ticks to wait, 0 if the buffer needs to be written now
+ */
+static TickType_t data_store_spill_wait_(const struct data_store_t *store) {
+  if (!store->is_pending) {
+    return portMAX_DELAY;
+  }
+  const TickType_t age = xTaskGetTickCount() - store->pending_since;
+  if (age >= SPILL_DELAY ||
+      store->buffers[store->active].count >= store->capacity / 2) {
+    return 0;
+  }
+  return SPILL_DELAY - age;
+}
+
+/**
+ * @brief Task writing the pending buffers of all stores to the storage.
+ *
+ * @param pvParameters unused
+ */
+static void data_store_writer_task_(void *pvParameters) {
+  while (1) {
+    // Buffers may already be pending before the task is started.
+    TickType_t timeout = portMAX_DELAY;
+    for (unsigned int i = 0; i < nr_stores_; i++) {
+      struct data_store_t *store = stores_[i];
+      if (xSemaphoreTake(store->storage_mutex, portMAX_DELAY) != pdTRUE) {
+        continue;
+      }
+      TickType_t wait = portMAX_DELAY;
+      if (xSemaphoreTake(store->mutex, portMAX_DELAY) == pdTRUE) {
+        wait = data_store_spill_wait_(store);
+        xSemaphoreGive(store->mutex);
+      }
+      if (wait == 0 && !data_store_write_pending_(store)) {
+        wait = WRITER_RETRY_TIMEOUT;
+      }
+      if (wait > 0 && wait < timeout) {
+        timeout = wait;
+      }
+      xSemaphoreGive(store->storage_mutex);
+    }
+    ulTaskNotifyTake(pdTRUE, timeout);
+  }
+}
+
+/**
+ * @brief Decode the next records of the oldest segment for replaying.
+ *
+ * Segments are removed from the storage after all records are read.
+ *
+ * @param store store to fill
+ */
+static void data_store_read_from_disc_(struct data_store_t *store) {
+  const unsigned int max_count =
+      DATA_STORE_REPLAY_WINDOW_SIZE / store->item_size;
+  while (data_store_backend_nr_segments(store) > 0) {
+    size_t size;
+    const uint8_t *data = data_store_backend_read(
+        store, data_store_backend_first_segment(store), store->replay_offset,
+        DATA_STORE_REPLAY_WINDOW_SIZE, &size);
+    size_t pos = 0;
+    bool is_first = false;
+    if (data != NULL && store->replay_offset == 0) {
+      struct data_store_segment_header_t header;
+      pos = data_store_read_segment_header(data, size, &header);
+      if (pos == 0) {
+        ESP_LOGE(TAG, "Unknown format of %s data segment", store->name);
+        data = NULL;
+      }
+      is_first = true;
+    }
+    unsigned int count = 0;
+    uint64_t values[DATA_STORE_MAX_FIELDS];
+    while (data != NULL && count < max_count) {
+      const size_t encoded_size = data_store_decode_record(
+          store, data + pos, size - pos, is_first ? NULL : store->replay_prev,
+          values);
+      if (encoded_size == 0) {
+        break;
+      }
+      data_store_write_fields(store, values,
+                              store->replay_items + count * store->item_size);
+      memcpy(store->replay_prev, values, sizeof(values));
+      pos += encoded_size;
+      is_first = false;
+      count++;
+    }
+    if (count > 0) {
+      store->replay_count = count;
+      store->replay_pos = 0;
+      store->replay_offset += pos;
+      return;
+    }
+    if (store->in_flight_count > 0) {
+      // Removed once its records are committed, so a restart meanwhile
+      // replays them again.
+      return;
+    }
+    if (data != NULL && pos < size) {
+      ESP_LOGE(TAG, "Dropping incomplete %s data segment", store->name);
+    }
+    // Segment completely replayed or not readable
+    data_store_backend_remove_oldest(store);
+    store->replay_offset = 0;
+  }
+}
+
+void data_store_reset_replay(struct data_store_t *store) {
+  store->replay_offset = 0;
+  store->replay_count = 0;
+  store->replay_pos = 0;
+  // Records in flight are only read from the oldest segment, which is removed.
+  memset(store->in_flight_is_stored, 0, sizeof(store->in_flight_is_stored));
+}
+
+/**
+ * @brief Get the NVS key of the reserved sequence numbers of a store.
+ *
+ * Long store names are truncated to the maximum key length.
+ *
+ * @param store store of the stream
+ * @param key output for the key
+ */
+static void data_store_sequence_key_(const struct data_store_t *store,
+                                     char key[NVS_KEY_NAME_MAX_SIZE]) {
+  snprintf(key, NVS_KEY_NAME_MAX_SIZE, "seq_%s", store->name);
+}
+
+/**
+ * @brief Continue the sequence numbers behind the ones reserved before.
+ *
+ * @param store store to initialize
+ */
+static void data_store_sequence_init_(struct data_store_t *store) {
+  store->next_record_seq = 0;
+  store->record_seq_limit = 0;
+  nvs_handle_t handle;
+  if (nvs_open(SEQUENCE_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+    return;
+  }
+  char key[NVS_KEY_NAME_MAX_SIZE];
+  data_store_sequence_key_(store, key);
+  uint32_t limit;
+  if (nvs_get_u32(handle, key, &limit) == ESP_OK) {
+    store->next_record_seq = limit;
+    store->record_seq_limit = limit;
+  }
+  nvs_close(handle);
+}
+
+/**
+ * @brief Reserve the next block of sequence numbers in NVS.
+ *
+ * @param store store of the stream
+ * @param limit first sequence number not reserved
+ * @return esp_err_t ESP_OK on success
+ */
+static esp_err_t data_store_sequence_reserve_(const struct data_store_t *store,
+                                              uint32_t limit) {
+  nvs_handle_t handle;
+  esp_err_t err = nvs_open(SEQUENCE_NAMESPACE, NVS_READWRITE, &handle);
+  if (err != ESP_OK) {
+    return err;
+  }
+  char key[NVS_KEY_NAME_MAX_SIZE];
+  data_store_sequence_key_(store, key);
+  err = nvs_set_u32(handle, key, limit);
+  if (err == ESP_OK) {
+    err = nvs_commit(handle);
+  }
+  nvs_close(handle);
+  return err;
+}
+
+uint32_t data_store_next_sequence(struct data_store_t *store) {
+  if (xSemaphoreTake(store->mutex, portMAX_DELAY) != pdTRUE) {
+    return 0;
+  }
+  if (store->next_record_seq == store->record_seq_limit) {
+    const uint32_t limit = store->record_seq_limit + DATA_STORE_SEQUENCE_BLOCK;
+    const esp_err_t err = data_store_sequence_reserve_(store, limit);
+    if (err != ESP_OK) {
+      // Keep counting, only a reboot may repeat sequence numbers.
+      ESP_LOGW(TAG, "Failed to reserve %s sequence numbers: %s", store->name,
+               esp_err_to_name(err));
+    }
+    store->record_seq_limit = limit;
+  }
+  const uint32_t seq = store->next_record_seq++;
+  xSemaphoreGive(store->mutex);
+  return seq;
+}
+
+esp_err_t data_store_mount_storage() {
+  const int64_t start = esp_timer_get_time();
+  const esp_err_t err = data_store_backend_mount();
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to mount the storage: %s", esp_err_to_name(err));
+    return err;
+  }
+  ESP_LOGI(TAG, "Storage mounted in %lld us", esp_timer_get_time() - start);
+  return ESP_OK;
+}
+
+void data_store_idle() { data_store_backend_idle(); }
+
+void data_store_init(struct data_store_t *store) {
+  store->mutex = xSemaphoreCreateMutexStatic(&store->mutex_buffer);
+  store->storage_mutex =
+      xSemaphoreCreateMutexStatic(&store->storage_mutex_buffer);
+  store->packed_size = data_store_packed_size(store);
+  store->capacity = store->buffer_size / 2 / store->packed_size;
+  for (unsigned int i = 0; i < 2; i++) {
+    store->buffers[i].head = 0;
+    store->buffers[i].tail = 0;
+    store->buffers[i].count = 0;
+  }
+  store->active = 0;
+  store->is_pending = false;
+  store->nr_dropped = 0;
+  store->nr_evicted = 0;
+  data_store_sequence_init_(store);
+  store->in_flight_tail = 0;
+  store->in_flight_count = 0;
+  store->in_flight_pos = 0;
+#if CONFIG_MQTT_DATA_BULK_SHIPPING
+  // The benchmark store is always replayed.
+  store->is_shipped = store->stream_id < DATA_STORE_NR_STREAMS;
+#else
+  store->is_shipped = false;
+#endif
+  store->rtc_capacity = DATA_STORE_RTC_TAIL_SIZE / store->item_size;
+  data_store_reset_replay(store);
+  data_store_backend_init(store);
+  data_store_index_init(store);
+  if (nr_stores_ < MAX_STORES) {
+    stores_[nr_stores_++] = store;
+  }
+  data_store_rtc_tail_restore_(store);
+  ESP_LOGD(TAG, "%s data store initialized with 2x%u items and %u segments",
+           store->name, store->capacity,
+           data_store_backend_nr_segments(store));
+}
+
+void data_store_push(struct data_store_t *store, const void *item) {
+  if (xSemaphoreTake(store->mutex, portMAX_DELAY) != pdTRUE) {
+    return;
+  }
+  uint64_t values[DATA_STORE_MAX_FIELDS];
+  data_store_read_fields(store, item, values);
+  struct data_store_buffer_t *buffer = &store->buffers[store->active];
+  bool is_swapped = false;
+  if (buffer->count >= store->capacity ||
+      (buffer->count > 0 && !data_store_fits_buffer(store, values, buffer))) {
+    if (store->is_pending) {
+      // The writer task did not catch up, never wait for the storage.
+      store->nr_dropped++;
+      xSemaphoreGive(store->mutex);
+      if (writer_task_handle_ != NULL) {
+        xTaskNotifyGive(writer_task_handle_);
+      }
+      return;
+    }
+    data_store_swap_buffers_(store);
+    buffer = &store->buffers[store->active];
+    is_swapped = true;
+  }
+  const int64_t time = data_store_record_time(store, values);
+  if (buffer->count == 0) {
+    buffer->time_base = time;
+    buffer->seq_base = data_store_record_sequence(store, values);
+    buffer->max_time = time;
+  } else if (time > buffer->max_time) {
+    buffer->max_time = time;
+  }
+  data_store_pack_record(store, values, buffer,
+                         buffer->items + buffer->head * store->packed_size);
+  buffer->head = (buffer->head + 1) % store->capacity;
+  buffer->count++;
+  data_store_rtc_tail_append_(store, item);
+  // The writer task spills the pending buffer once the active one is half full.
+  const bool is_pressed =
+      store->is_pending && buffer->count == store->capacity / 2;
+  xSemaphoreGive(store->mutex);
+  if ((is_swapped || is_pressed) && writer_task_handle_ != NULL) {
+    xTaskNotifyGive(writer_task_handle_);
+  }
+}
+
+/**
+ * @brief Get a record of the in flight ring buffer.
+ *
+ * @param store store owning the records
+ * @param index index of the record, 0 is the oldest one
+ * @return uint8_t* the record
+ */
+static inline uint8_t *data_store_in_flight_item_(struct data_store_t *store,
+                                                  unsigned int index) {
+  return store->in_flight_items +
+         ((store->in_flight_tail + index) % DATA_STORE_MAX_IN_FLIGHT) *
+             store->item_size;
+}
+
+/**
+ * @brief Get the flag of a record in flight telling if it is still stored.
+ *
+ * @param store store owning the records
+ * @param index index of the record, 0 is the oldest one
+ * @return bool* the flag
+ */
+static inline bool *data_store_in_flight_is_stored_(struct data_store_t *store,
+                                                    unsigned int index) {
+  return &store->in_flight_is_stored[(store->in_flight_tail + index) %
+                                     DATA_STORE_MAX_IN_FLIGHT];
+}
+
+bool data_store_read(struct data_store_t *store, void *item) {
+  if (xSemaphoreTake(store->storage_mutex, portMAX_DELAY) != pdTRUE) {
+    return false;
+  }
+  bool is_read = store->in_flight_pos < store->in_flight_count;
+  if (!is_read && store->in_flight_count < DATA_STORE_MAX_IN_FLIGHT) {
+    // Segments on the storage are older than the records in the RAM buffers.
+    if (!store->is_shipped && store->replay_pos >= store->replay_count) {
+      data_store_read_from_disc_(store);
+    }
+    // The record is moved to the in flight records, so it is neither written
+    // by the writer task nor lost if the replayed segment is removed.
+    uint8_t *in_flight_item =
+        data_store_in_flight_item_(store, store->in_flight_count);
+    if (xSemaphoreTake(store->mutex, portMAX_DELAY) == pdTRUE) {
+      if (store->replay_pos < store->replay_count) {
+        memcpy(in_flight_item,
+               store->replay_items + store->replay_pos * store->item_size,
+               store->item_size);
+        store->replay_pos++;
+        is_read = true;
+        *data_store_in_flight_is_stored_(store, store->in_flight_count) = true;
+      } else if (!store->is_shipped &&
+                 data_store_backend_nr_segments(store) > 0) {
+        // The replayed segment waits for the commit of its records, the RAM
+        // buffers are newer.
+        is_read = false;
+      } else {
+        // The pending buffer is older than the active buffer.
+        is_read =
+            (store->is_pending &&
+             data_store_pop_buffer_(store, &store->buffers[store->active ^ 1],
+                                    in_flight_item)) ||
+            data_store_pop_buffer_(store, &store->buffers[store->active],
+                                   in_flight_item);
+        *data_store_in_flight_is_stored_(store, store->in_flight_count) = false;
+      }
+      xSemaphoreGive(store->mutex);
+    }
+    if (is_read) {
+      store->in_flight_count++;
+    }
+  }
+  if (is_read) {
+    memcpy(item, data_store_in_flight_item_(store, store->in_flight_pos),
+           store->item_size);
+    store->in_flight_pos++;
+  }
+  xSemaphoreGive(store->storage_mutex);
+  return is_read;
+}
+
+void data_store_commit(struct data_store_t *store, unsigned int nr_records) {
+  if (xSemaphoreTake(store->storage_mutex, portMAX_DELAY) != pdTRUE) {
+    return;
+  }
+  if (nr_records > store->in_flight_count) {
+    nr_records = store->in_flight_count;
+  }
+  store->in_flight_tail =
+      (store->in_flight_tail + nr_records) % DATA_STORE_MAX_IN_FLIGHT;
+  store->in_flight_count -= nr_records;
+  store->in_flight_pos =
+      store->in_flight_pos > nr_records ? store->in_flight_pos - nr_records : 0;
+  xSemaphoreGive(store->storage_mutex);
+}
+
+void data_store_rollback(struct data_store_t *store) {
+  if (xSemaphoreTake(store->storage_mutex, portMAX_DELAY) != pdTRUE) {
+    return;
+  }
+  store->in_flight_pos = 0;
+  xSemaphoreGive(store->storage_mutex);
+}
+
+bool data_store_is_empty(struct data_store_t *store) {
+  if (xSemaphoreTake(store->storage_mutex, 0) != pdTRUE) {
+    return false;
+  }
+  bool is_empty = false;
+  if (xSemaphoreTake(store->mutex, portMAX_DELAY) == pdTRUE) {
+    is_empty = store->in_flight_count == 0 && !store->is_pending &&
+               store->buffers[store->active].count == 0 &&
+               store->replay_pos >= store->replay_count &&
+               data_store_backend_nr_segments(store) == 0;
+    xSemaphoreGive(store->mutex);
+  }
+  xSemaphoreGive(store->storage_mutex);
+  return is_empty;
+}
+
+void data_store_flush(struct data_store_t *store) {
+  if (xSemaphoreTake(store->storage_mutex, portMAX_DELAY) != pdTRUE) {
+    return;
+  }
+  if (data_store_write_pending_(store) &&
+      xSemaphoreTake(store->mutex, portMAX_DELAY) == pdTRUE) {
+    if (store->buffers[store->active].count > 0) {
+      data_store_swap_buffers_(store);
+    }
+    xSemaphoreGive(store->mutex);
+    data_store_write_pending_(store);
+  }
+  xSemaphoreGive(store->storage_mutex);
+}
+
+/**
+ * @brief Read the next chunk of the oldest segment of a store.
+ *
+ * @param store store to read from
+ * @param chunk previous chunk, updated to the read chunk
+ * @param out output for the segment bytes
+ * @param max_size maximum number of segment bytes
+ * @return true if a chunk was read
+ */
+static bool data_store_read_chunk_(struct data_store_t *store,
+                                   struct data_store_chunk_t *chunk,
+                                   uint8_t *out, size_t max_size) {
+  if (xSemaphoreTake(store->storage_mutex, portMAX_DELAY) != pdTRUE) {
+    return false;
+  }
+  bool is_read = false;
+  if (data_store_backend_nr_segments(store) > 0) {
+    const uint32_t location = data_store_backend_first_segment(store);
+    const bool is_continued = chunk->size > 0 && !chunk->is_last &&
+                              chunk->stream_id == store->stream_id &&
+                              chunk->location == location;
+    const size_t offset = is_continued ? chunk->offset + chunk->size : 0;
+    // One more byte is requested to detect the end of the segment.
+    size_t size;
+    const uint8_t *data =
+        data_store_backend_read(store, location, offset, max_size + 1, &size);
+    if (data != NULL) {
+      *chunk = (struct data_store_chunk_t){
+          .stream_id = store->stream_id,
+          .location = location,
+          .offset = offset,
+          .size = size < max_size ? size : max_size,
+          .is_last = size <= max_size,
+      };
+      memcpy(out, data, chunk->size);
+      is_read = true;
+    } else if (offset == 0) {
+      ESP_LOGE(TAG, "Dropping unreadable %s data segment", store->name);
+      data_store_backend_remove_oldest(store);
+    }
+  }
+  xSemaphoreGive(store->storage_mutex);
+  return is_read;
+}
+
+size_t data_store_read_chunk(struct data_store_chunk_t *chunk, uint8_t *out,
+                             size_t max_size) {
+  struct data_store_chunk_header_t header = {
+      .version = DATA_STORE_CHUNK_VERSION,
+      .board_id = configuration.id,
+  };
+  if (max_size <= sizeof(header)) {
+    return 0;
+  }
+  // The file backend reads at most one replay window at once.
+  size_t max_data_size = max_size - sizeof(header);
+  if (max_data_size >= DATA_STORE_REPLAY_WINDOW_SIZE) {
+    max_data_size = DATA_STORE_REPLAY_WINDOW_SIZE - 1;
+  }
+  // First try to stay with the stream of the previous chunk.
+  struct data_store_t *store = NULL;
+  for (unsigned int pass = 0; pass < 2 && store == NULL; pass++) {
+    for (unsigned int i = 0; i < nr_stores_ && store == NULL; i++) {
+      if (stores_[i]->is_shipped &&
+          (pass > 0 || stores_[i]->stream_id == chunk->stream_id) &&
+          data_store_read_chunk_(stores_[i], chunk, out + sizeof(header),
+                                 max_data_size)) {
+        store = stores_[i];
+      }
+    }
+  }
+  if (store == NULL) {
+    return 0;
+  }
+  header.stream_id = store->stream_id;
+  header.flags = chunk->is_last ? DATA_STORE_CHUNK_LAST : 0;
+  header.location = chunk->location;
+  header.offset = chunk->offset;
+  header.nr_fields = store->nr_fields;
+  for (unsigned int i = 0; i < store->nr_fields; i++) {
+    header.field_types[i] = store->fields[i].type;
+  }
+  memcpy(out, &header, sizeof(header));
+  return sizeof(header) + chunk->size;
+}
+
+void data_store_remove_segment(const struct data_store_chunk_t *chunk) {
+  for (unsigned int i = 0; i < nr_stores_; i++) {
+    struct data_store_t *store = stores_[i];
+    if (store->stream_id != chunk->stream_id ||
+        xSemaphoreTake(store->storage_mutex, portMAX_DELAY) != pdTRUE) {
+      continue;
+    }
+    if (data_store_backend_nr_segments(store) > 0 &&
+        data_store_backend_first_segment(store) == chunk->location) {
+      data_store_backend_remove_oldest(store);
+      data_store_reset_replay(store);
+    }
+    xSemaphoreGive(store->storage_mutex);
+  }
+}
+
+/**
+ * @brief Check if all records of the RAM buffers are mirrored in RTC memory.
+ *
+ * @param store store to check
+ * @return true if the RTC tail buffer holds all records of the RAM buffers
+ */
+static bool data_store_is_mirrored_(struct data_store_t *store) {
+  if (xSemaphoreTake(store->mutex, portMAX_DELAY) != pdTRUE) {
+    return false;
+  }
+  unsigned int nr_ram_records = store->buffers[store->active].count;
+  if (store->is_pending) {
+    nr_ram_records += store->buffers[store->active ^ 1].count;
+  }
+  const bool is_mirrored = store->rtc_tail->count == nr_ram_records;
+  xSemaphoreGive(store->mutex);
+  return is_mirrored;
+}
+
+/**
+ * @brief Read the fields of a record read from the RAM buffers but not
+ * committed.
+ *
+ * @param store store owning the record
+ * @param source indices of the records in flight to write
+ * @param index index in source
+ * @param values output for the field values
+ */
+static void data_store_read_in_flight_record_(struct data_store_t *store,
+                                              const void *source,
+                                              unsigned int index,
+                                              uint64_t *values) {
+  const unsigned int *indices = source;
+  data_store_read_fields(
+      store, data_store_in_flight_item_(store, indices[index]), values);
+}
+
+/**
+ * @brief Write the records read from the RAM buffers but not committed as a
+ * new segment.
+ *
+ * Their acknowledgement is lost with a restart, so they are sent again
+ * afterwards. They are older than the records in the RAM buffers and are
+ * written before them. Records read from a segment are replayed from it again
+ * and are not written twice.
+ *
+ * @param store store to write
+ */
+static void data_store_flush_in_flight_(struct data_store_t *store) {
+  if (xSemaphoreTake(store->storage_mutex, portMAX_DELAY) != pdTRUE) {
+    return;
+  }
+  // Taken before writing, as making space may evict the oldest segment.
+  unsigned int indices[DATA_STORE_MAX_IN_FLIGHT];
+  unsigned int nr_records = 0;
+  for (unsigned int i = 0; i < store->in_flight_count; i++) {
+    if (!*data_store_in_flight_is_stored_(store, i)) {
+      indices[nr_records++] = i;
+    }
+  }
+  bool is_written = true;
+  if (nr_records > 0) {
+    uint64_t values[DATA_STORE_MAX_FIELDS];
+    int64_t min_time = INT64_MAX;
+    int64_t max_time = INT64_MIN;
+    for (unsigned int i = 0; i < nr_records; i++) {
+      data_store_read_in_flight_record_(store, indices, i, values);
+      const int64_t time = data_store_record_time(store, values);
+      min_time = time < min_time ? time : min_time;
+      max_time = time > max_time ? time : max_time;
+    }
+    is_written =
+        data_store_write_segment_(store, nr_records, min_time, max_time,
+                                  data_store_read_in_flight_record_, indices);
+  }
+  if (is_written) {
+    store->in_flight_count = 0;
+    store->in_flight_pos = 0;
+  }
+  xSemaphoreGive(store->storage_mutex);
+}
+
+void data_store_flush_all() {
+  for (unsigned int i = 0; i < nr_stores_; i++) {
+    data_store_flush_in_flight_(stores_[i]);
+    // Restored from RTC memory after the restart without a flash write.
+    if (!data_store_is_mirrored_(stores_[i])) {
+      data_store_flush(stores_[i]);
+    }
+  }
+}
+
+TaskHandle_t data_store_create_writer_task() {
+  // Static task without dynamic memory allocation
+  writer_task_handle_ = xTaskCreateStatic(
+      data_store_writer_task_, "DataStoreWriter", /* Task Name */
+      STACK_SIZE,           /* Number of indexes in the xStack array. */
+      NULL,                 /* No Parameter */
+      tskIDLE_PRIORITY + 1, /* Priority at which the task is created. */
+      xStack,               /* Array to use as the task's stack. */
+      &xTaskBuffer);        /* Variable to hold the task's data structure. */
+  return writer_task_handle_;
+}
+
+esp_err_t data_store_storage_info(size_t *total_bytes, size_t *used_bytes) {
+  return data_store_backend_info(total_bytes, used_bytes);
+}
+
+void data_store_add_usage_json(cJSON *data) {
+  for (unsigned int i = 0; i < nr_stores_; i++) {
+    struct data_store_t *store = stores_[i];
+    if (store->stream_id >= DATA_STORE_NR_STREAMS ||
+        xSemaphoreTake(store->storage_mutex, portMAX_DELAY) != pdTRUE) {
+      continue;
+    }
+    const size_t used_bytes = store->used_bytes;
+    const unsigned int nr_evicted = store->nr_evicted;
+    xSemaphoreGive(store->storage_mutex);
+    cJSON *usage = cJSON_AddObjectToObject(data, store->name);
+    cJSON_AddNumberToObject(usage, "used_bytes", used_bytes);
+    cJSON_AddNumberToObject(usage, "quota_bytes", store->quota);
+    cJSON_AddNumberToObject(usage, "evicted_segments", nr_evicted);
+  }
+}
+
+/**
+ * @brief Get the timestamp of the oldest record of a RAM buffer.
+ *
+ * Needs to be called with the mutex taken.
+ *
+ * @param store store owning the buffer
+ * @param buffer buffer to check
+ * @param oldest_time output for the timestamp
+ * @return true if the buffer holds a record
+ */
+static bool
+data_store_buffer_oldest_time_(const struct data_store_t *store,
+                               const struct data_store_buffer_t *buffer,
+                               int64_t *oldest_time) {
+  if (buffer->count == 0) {
+    return false;
+  }
+  uint64_t values[DATA_STORE_MAX_FIELDS];
+  data_store_unpack_record(store,
+                           buffer->items + buffer->tail * store->packed_size,
+                           buffer, values);
+  *oldest_time = data_store_record_time(store, values);
+  return true;
+}
+
+void data_store_get_stats(struct data_store_t *store,
+                          struct data_store_stats_t *stats) {
+  *stats = (struct data_store_stats_t){0};
+  if (xSemaphoreTake(store->storage_mutex, portMAX_DELAY) != pdTRUE) {
+    return;
+  }
+  uint64_t values[DATA_STORE_MAX_FIELDS];
+  // Records are sent from the in flight records, the replayed segment, the
+  // storage, the pending and the active buffer, so the first found is oldest.
+  if (store->in_flight_count > 0) {
+    data_store_read_fields(store, data_store_in_flight_item_(store, 0),
+                           values);
+    stats->oldest_time = data_store_record_time(store, values);
+    stats->has_oldest = true;
+  } else if (store->replay_pos < store->replay_count) {
+    data_store_read_fields(
+        store, store->replay_items + store->replay_pos * store->item_size,
+        values);
+    stats->oldest_time = data_store_record_time(store, values);
+    stats->has_oldest = true;
+  } else {
+    stats->has_oldest =
+        data_store_index_oldest_time(store, &stats->oldest_time);
+  }
+  stats->nr_segments = data_store_backend_nr_segments(store);
+  stats->used_bytes = store->used_bytes;
+  stats->nr_evicted = store->nr_evicted;
+  stats->nr_records = store->in_flight_count;
+  if (xSemaphoreTake(store->mutex, portMAX_DELAY) == pdTRUE) {
+    const struct data_store_buffer_t *active = &store->buffers[store->active];
+    const struct data_store_buffer_t *pending =
+        &store->buffers[store->active ^ 1];
+    if (store->is_pending) {
+      stats->nr_records += pending->count;
+      stats->has_oldest =
+          stats->has_oldest ||
+          data_store_buffer_oldest_time_(store, pending, &stats->oldest_time);
+    }
+    stats->nr_records += active->count;
+    stats->has_oldest =
+        stats->has_oldest ||
+        data_store_buffer_oldest_time_(store, active, &stats->oldest_time);
+    stats->nr_dropped = store->nr_dropped;
+    xSemaphoreGive(store->mutex);
+  }
+  xSemaphoreGive(store->storage_mutex);
+}
+
+cJSON *data_store_create_json(time_t timestamp, uint32_t seq, uint16_t boot_id,
+                              bool is_clock_unsynced) {
+  cJSON *data = cJSON_CreateObject();
+  // add id
+  cJSON_AddNumberToObject(data, "id", configuration.id);
+  cJSON_AddNumberToObject(data, "seq", seq);
+  const enum data_clock_quality quality =
+      data_clock_rebase(boot_id, is_clock_unsynced, &timestamp);
+  cJSON_AddStringToObject(data, "clock", data_clock_quality_name(quality));
+  if (quality == DATA_CLOCK_UNSYNCED) {
+    cJSON_AddNumberToObject(data, "boot", boot_id);
+  }
+  // add timestamp
+  struct tm timeinfo;
+  localtime_r(&timestamp, &timeinfo);
+  char time_string[32];
+  int time_len = strftime(time_string, sizeof(time_string), "%FT%T", &timeinfo);
+
+  struct timeval tv_now;
+  gettimeofday(&tv_now, NULL);
+  time_len += snprintf(time_string + time_len, sizeof(time_string) - time_len,
+                       ".%06ld", tv_now.tv_usec);
+  strftime(time_string + time_len, sizeof(time_string) - time_len, "%z",
+           &timeinfo);
+  cJSON_AddStringToObject(data, "ts", time_string);
+  return data;
+}
+
+void data_store_add_fields_json(const struct data_store_t *store,
+                                const void *item, cJSON *data) {
+  uint64_t values[DATA_STORE_MAX_FIELDS];
+  data_store_read_fields(store, item, values);
+  for (unsigned int i = 0; i < store->nr_fields; i++) {
+    const struct data_store_field_t *field = &store->fields[i];
+    // Signed fields are sign extended by data_store_read_fields.
+    const double value = field->type == DATA_STORE_FIELD_SIGNED
+                             ? (double)(int64_t)values[i]
+                             : (double)values[i];
+    switch (field->json) {
+    case DATA_STORE_JSON_NONZERO:
+      if (values[i] == 0) {
+        break;
+      }
+      // fall through
+    case DATA_STORE_JSON_NUMBER:
+      cJSON_AddNumberToObject(data, field->name, value);
+      break;
+    case DATA_STORE_JSON_BOOL:
+      cJSON_AddBoolToObject(data, field->name, values[i] != 0);
+      break;
+    default:
+      break;
+    }
+  }
+}
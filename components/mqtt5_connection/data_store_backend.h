@@ -0,0 +1,175 @@
+#ifndef COMPONENTS_MQTT5_CONNECTION_DATA_STORE_BACKEND
+#define COMPONENTS_MQTT5_CONNECTION_DATA_STORE_BACKEND
+/**
+ * @brief Storage backend of the data stores.
+ *
+ * Internal interface between the data store and the storage of the segments.
+ * Exactly one backend is compiled in, selected by the configuration. All
+ * functions taking a store are called with the storage mutex of the store
+ * taken. The backend keeps store->used_bytes up to date.
+ *
+ */
+
+#include "data_store.h"
+
+/**
+ * @brief Mount the storage partition.
+ *
+ * Called once before any store is initialized.
+ *
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t data_store_backend_mount();
+
+/**
+ * @brief Unmount the storage partition.
+ *
+ * Only used by the benchmark while no store accesses the storage.
+ */
+void data_store_backend_unmount();
+
+/**
+ * @brief Do maintenance work on the storage while the data logging is idle.
+ *
+ * Work done here is saved on the following segment writes.
+ */
+void data_store_backend_idle();
+
+/**
+ * @brief Recover the segments of a store left from a previous run.
+ *
+ * @param store store to initialize
+ */
+void data_store_backend_init(struct data_store_t *store);
+
+/**
+ * @brief Get the number of segments of a store on the storage.
+ *
+ * @param store store to check
+ * @return unsigned int number of segments
+ */
+unsigned int data_store_backend_nr_segments(const struct data_store_t *store);
+
+/**
+ * @brief Get the location of the oldest segment of a store.
+ *
+ * A location identifies a segment until it is removed.
+ *
+ * @param store store to check
+ * @return uint32_t location of the oldest segment
+ */
+uint32_t data_store_backend_first_segment(const struct data_store_t *store);
+
+/**
+ * @brief Get the location of the segment following a segment.
+ *
+ * @param store store to check
+ * @param location location of a segment which is not the newest one
+ * @return uint32_t location of the following segment
+ */
+uint32_t data_store_backend_next_segment(const struct data_store_t *store,
+                                         uint32_t location);
+
+/**
+ * @brief Get the location of the next segment which is written.
+ *
+ * Only valid between data_store_backend_begin_segment and
+ * data_store_backend_end_segment.
+ *
+ * @param store store to check
+ * @return uint32_t location of the segment being written
+ */
+uint32_t data_store_backend_head_segment(const struct data_store_t *store);
+
+/**
+ * @brief Start writing a new segment to the storage.
+ *
+ * The content is added with data_store_backend_append. Afterwards the segment
+ * is completed with data_store_backend_end_segment.
+ *
+ * @param store store to write to
+ * @param max_size upper bound of the size of the segment in bytes
+ * @return true if the segment was started
+ */
+bool data_store_backend_begin_segment(struct data_store_t *store,
+                                      size_t max_size);
+
+/**
+ * @brief Append data to the segment being written.
+ *
+ * @param store store to write to
+ * @param data data to append
+ * @param size size of the data in bytes
+ * @return true if all data was written
+ */
+bool data_store_backend_append(struct data_store_t *store, const uint8_t *data,
+                               size_t size);
+
+/**
+ * @brief Complete the segment being written.
+ *
+ * @param store store to write to
+ * @param commit true to add the segment to the storage, false to discard it
+ * @return true if the segment was added to the storage
+ */
+bool data_store_backend_end_segment(struct data_store_t *store, bool commit);
+
+/**
+ * @brief Read from a segment of a store.
+ *
+ * The returned pointer is valid until the next call of any backend function
+ * for this store.
+ *
+ * @param store store to read from
+ * @param location location of the segment
+ * @param offset offset in the segment to start reading from
+ * @param max_size maximum number of bytes requested
+ * @param size output for the number of bytes available at the returned
+ * pointer. 0 if the end of the segment is reached.
+ * @return const uint8_t* pointer to the data, NULL if nothing could be read
+ */
+const uint8_t *data_store_backend_read(struct data_store_t *store,
+                                       uint32_t location, size_t offset,
+                                       size_t max_size, size_t *size);
+
+/**
+ * @brief Remove the oldest segment of a store from the storage.
+ *
+ * @param store store to remove from
+ */
+void data_store_backend_remove_oldest(struct data_store_t *store);
+
+/**
+ * @brief Check if the storage has space for a new segment.
+ *
+ * Only checks the space shared by all streams, the quota of the stream is
+ * checked by the store.
+ *
+ * @param store store to write to
+ * @param max_size upper bound of the size of the segment in bytes
+ * @return true if the segment fits
+ */
+bool data_store_backend_has_space(const struct data_store_t *store,
+                                  size_t max_size);
+
+/**
+ * @brief Get the size and the usage of the storage.
+ *
+ * @param total_bytes output for the size of the storage
+ * @param used_bytes output for the used bytes of the storage
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t data_store_backend_info(size_t *total_bytes, size_t *used_bytes);
+
+/**
+ * @brief Drop the replay state of a store.
+ *
+ * Needs to be called by a backend if the oldest segment of the store is
+ * removed without the store requesting it. The records in flight are no longer
+ * stored in a segment afterwards.
+ *
+ * @param store store to reset
+ */
+void data_store_reset_replay(struct data_store_t *store);
+
+#endif /* COMPONENTS_MQTT5_CONNECTION_DATA_STORE_BACKEND */
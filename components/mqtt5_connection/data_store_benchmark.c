@@ -0,0 +1,173 @@
+#include "data_store.h"
+#include "data_store_backend.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char *TAG = "data_store_benchmark";
+
+/** @brief Number of segments written by the benchmark. */
+#define BENCHMARK_NR_SEGMENTS 8
+
+#if !CONFIG_MQTT_DATA_LOGGING_BACKEND_FLASH_LOG
+/** @brief Fill level of the partition during the benchmark in percent. */
+#define BENCHMARK_FILL_PERCENT 90
+/** @brief File filling the partition during the benchmark. */
+#define BENCHMARK_FILL_PATH "/store/bench_fill"
+#endif
+
+struct benchmark_data_item_t {
+  time_t timestamp;
+  uint32_t counter;
+};
+
+static const struct data_store_field_t benchmark_data_fields_[] = {
+    DATA_STORE_FIELD(struct benchmark_data_item_t, timestamp,
+                     DATA_STORE_FIELD_TIME, 32),
+    DATA_STORE_FIELD(struct benchmark_data_item_t, counter,
+                     DATA_STORE_FIELD_UNSIGNED, 32),
+};
+
+/** @brief Size of the RAM buffers of the benchmark store in pages. */
+#define BENCHMARK_BUFFER_PAGES 120
+
+#define BENCHMARK_DATA_BUFFER_SIZE                                             \
+  DATA_STORE_BUFFER_SIZE(BENCHMARK_BUFFER_PAGES)
+
+// The benchmark uses its own stream behind the regular streams.
+DATA_STORE_DEFINE(benchmark_data_store_, "benchmark", DATA_STORE_NR_STREAMS,
+                  struct benchmark_data_item_t, benchmark_data_fields_,
+                  "/store/log_data/bench", BENCHMARK_DATA_BUFFER_SIZE,
+                  BENCHMARK_NR_SEGMENTS * BENCHMARK_DATA_BUFFER_SIZE);
+
+/**
+ * @brief Calculate a throughput in kB/s.
+ *
+ * @param bytes number of processed bytes
+ * @param duration_us duration in microseconds
+ * @return unsigned long throughput in kB/s
+ */
+static unsigned long throughput_kb_per_s(size_t bytes, int64_t duration_us) {
+  return duration_us > 0 ? (unsigned long)(bytes * 1000000LL /
+                                           (duration_us * 1024))
+                         : 0;
+}
+
+#if !CONFIG_MQTT_DATA_LOGGING_BACKEND_FLASH_LOG
+/**
+ * @brief Fill the partition with a file up to BENCHMARK_FILL_PERCENT.
+ *
+ * @return unsigned int fill level of the partition in percent
+ */
+static unsigned int fill_storage() {
+  size_t total_bytes, used_bytes;
+  if (data_store_storage_info(&total_bytes, &used_bytes) != ESP_OK ||
+      total_bytes == 0) {
+    return 0;
+  }
+  const size_t fill_bytes = total_bytes / 100 * BENCHMARK_FILL_PERCENT;
+  int fd = open(BENCHMARK_FILL_PATH, O_WRONLY | O_CREAT | O_TRUNC, 0);
+  if (fd < 0) {
+    ESP_LOGE(TAG, "Failed to create %s", BENCHMARK_FILL_PATH);
+    return used_bytes * 100 / total_bytes;
+  }
+  static uint8_t block[512];
+  memset(block, 0xa5, sizeof(block));
+  while (used_bytes < fill_bytes) {
+    const int written_bytes = write(fd, block, sizeof(block));
+    if (written_bytes <= 0) {
+      break;
+    }
+    used_bytes += written_bytes;
+  }
+  close(fd);
+  return used_bytes * 100 / total_bytes;
+}
+
+/**
+ * @brief Measure the time to mount the partition.
+ *
+ * No store may access the storage meanwhile.
+ *
+ * @return int64_t duration in microseconds, negative if mounting failed
+ */
+static int64_t remount_storage() {
+  data_store_backend_unmount();
+  const int64_t start = esp_timer_get_time();
+  const esp_err_t err = data_store_backend_mount();
+  const int64_t duration = esp_timer_get_time() - start;
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to mount the storage: %s", esp_err_to_name(err));
+    return -1;
+  }
+  return duration;
+}
+#endif
+
+void data_store_benchmark() {
+  data_store_init(&benchmark_data_store_);
+  // Drop records left from an interrupted run.
+  struct benchmark_data_item_t item = {0};
+  while (data_store_read(&benchmark_data_store_, &item)) {
+    data_store_commit(&benchmark_data_store_, 1);
+  }
+
+#if !CONFIG_MQTT_DATA_LOGGING_BACKEND_FLASH_LOG
+  // Mount time and write latency of the file systems grow with the fill level.
+  const unsigned int fill_percent = fill_storage();
+  ESP_LOGI(TAG, "Mounted at %u%% fill in %lld us", fill_percent,
+           remount_storage());
+#endif
+
+  const unsigned int nr_items =
+      BENCHMARK_NR_SEGMENTS * benchmark_data_store_.capacity;
+  const size_t nr_bytes = nr_items * sizeof(item);
+
+  // Each segment is flushed synchronously to include the storage writes.
+  int64_t max_flush_duration = 0;
+  const int64_t write_start = esp_timer_get_time();
+  for (unsigned int i = 0; i < nr_items; i++) {
+    time(&item.timestamp);
+    item.counter = i;
+    data_store_push(&benchmark_data_store_, &item);
+    if ((i + 1) % benchmark_data_store_.capacity == 0) {
+      const int64_t flush_start = esp_timer_get_time();
+      data_store_flush(&benchmark_data_store_);
+      const int64_t flush_duration = esp_timer_get_time() - flush_start;
+      if (flush_duration > max_flush_duration) {
+        max_flush_duration = flush_duration;
+      }
+    }
+  }
+  const int64_t write_duration = esp_timer_get_time() - write_start;
+
+  unsigned int nr_read_items = 0;
+  unsigned int nr_errors = 0;
+  const int64_t read_start = esp_timer_get_time();
+  while (data_store_read(&benchmark_data_store_, &item)) {
+    data_store_commit(&benchmark_data_store_, 1);
+    if (item.counter != nr_read_items) {
+      nr_errors++;
+    }
+    nr_read_items++;
+  }
+  const int64_t read_duration = esp_timer_get_time() - read_start;
+
+#if !CONFIG_MQTT_DATA_LOGGING_BACKEND_FLASH_LOG
+  remove(BENCHMARK_FILL_PATH);
+#endif
+
+  ESP_LOGI(TAG, "Wrote %u bytes in %lld us: %lu kB/s", nr_bytes,
+           write_duration, throughput_kb_per_s(nr_bytes, write_duration));
+  ESP_LOGI(TAG, "Worst-case segment write took %lld us", max_flush_duration);
+  ESP_LOGI(TAG, "Replayed %u of %u records in %lld us: %lu kB/s",
+           nr_read_items, nr_items, read_duration,
+           throughput_kb_per_s(nr_read_items * sizeof(item), read_duration));
+  if (nr_errors > 0) {
+    ESP_LOGE(TAG, "%u records replayed out of order", nr_errors);
+  }
+}
@@ -0,0 +1,276 @@
+#include "data_store_codec.h"
+
+#include "esp_rom_crc.h"
+#include <string.h>
+
+/**
+ * @brief Get the number of bits of a field in a packed record.
+ *
+ * @param field description of the field
+ * @return unsigned int number of bits
+ */
+static inline unsigned int packed_bits(const struct data_store_field_t *field) {
+  return field->type == DATA_STORE_FIELD_TIME   ? 32
+         : field->type == DATA_STORE_FIELD_BOOL ? 1
+                                                : field->bits;
+}
+
+static inline uint64_t sign_extend(uint64_t value, unsigned int bits) {
+  if (bits < 64 && (value >> (bits - 1)) & 1) {
+    value |= UINT64_MAX << bits;
+  }
+  return value;
+}
+
+static inline size_t write_varint(uint8_t *out, uint64_t value) {
+  size_t size = 0;
+  while (value >= 0x80) {
+    out[size++] = (uint8_t)value | 0x80;
+    value >>= 7;
+  }
+  out[size++] = (uint8_t)value;
+  return size;
+}
+
+/**
+ * @brief Read a varint.
+ *
+ * @param data encoded data
+ * @param size number of bytes available at data
+ * @param pos position to read from, advanced behind the varint
+ * @param value output for the value
+ * @return true if a complete varint was read
+ */
+static bool read_varint(const uint8_t *data, size_t size, size_t *pos,
+                        uint64_t *value) {
+  *value = 0;
+  for (unsigned int shift = 0; *pos < size && shift < 64; shift += 7) {
+    const uint8_t byte = data[(*pos)++];
+    *value |= (uint64_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline uint64_t zigzag_encode(uint64_t delta) {
+  return (delta << 1) ^ (uint64_t)((int64_t)delta >> 63);
+}
+
+static inline uint64_t zigzag_decode(uint64_t value) {
+  return (value >> 1) ^ (~(value & 1) + 1);
+}
+
+/**
+ * @brief Calculate the crc of a segment header.
+ *
+ * @param header header to check
+ * @return uint32_t crc32 of the header with its crc field set to 0
+ */
+static uint32_t
+segment_header_crc(const struct data_store_segment_header_t *header) {
+  struct data_store_segment_header_t copy = *header;
+  copy.crc = 0;
+  return esp_rom_crc32_le(0, (const uint8_t *)&copy, sizeof(copy));
+}
+
+void data_store_seal_segment_header(
+    struct data_store_segment_header_t *header) {
+  header->magic = DATA_STORE_SEGMENT_MAGIC;
+  header->format = DATA_STORE_SEGMENT_FORMAT;
+  header->crc = segment_header_crc(header);
+}
+
+size_t
+data_store_read_segment_header(const uint8_t *data, size_t size,
+                               struct data_store_segment_header_t *header) {
+  if (size < sizeof(*header)) {
+    return 0;
+  }
+  memcpy(header, data, sizeof(*header));
+  if (header->magic != DATA_STORE_SEGMENT_MAGIC ||
+      header->format != DATA_STORE_SEGMENT_FORMAT ||
+      header->crc != segment_header_crc(header)) {
+    return 0;
+  }
+  return sizeof(*header);
+}
+
+size_t data_store_packed_size(const struct data_store_t *store) {
+  unsigned int bits = 0;
+  for (unsigned int i = 0; i < store->nr_fields; i++) {
+    bits += packed_bits(&store->fields[i]);
+  }
+  return (bits + 7) / 8;
+}
+
+size_t data_store_max_encoded_size(const struct data_store_t *store) {
+  size_t size = (store->nr_fields + 6) / 7; // bit mask of changed fields
+  for (unsigned int i = 0; i < store->nr_fields; i++) {
+    if (store->fields[i].type != DATA_STORE_FIELD_BOOL) {
+      // The difference of two values needs one more bit.
+      size += (packed_bits(&store->fields[i]) + 1 + 6) / 7;
+    }
+  }
+  return size;
+}
+
+void data_store_read_fields(const struct data_store_t *store,
+                            const uint8_t *item, uint64_t *values) {
+  for (unsigned int i = 0; i < store->nr_fields; i++) {
+    const struct data_store_field_t *field = &store->fields[i];
+    values[i] = 0;
+    if (field->type == DATA_STORE_FIELD_BOOL) {
+      values[i] = item[field->offset] != 0;
+      continue;
+    }
+    // The records are stored little endian.
+    memcpy(&values[i], item + field->offset, field->size);
+    if (field->type == DATA_STORE_FIELD_SIGNED ||
+        field->type == DATA_STORE_FIELD_TIME) {
+      values[i] = sign_extend(values[i], 8 * field->size);
+    }
+  }
+}
+
+void data_store_write_fields(const struct data_store_t *store,
+                             const uint64_t *values, uint8_t *item) {
+  memset(item, 0, store->item_size);
+  for (unsigned int i = 0; i < store->nr_fields; i++) {
+    memcpy(item + store->fields[i].offset, &values[i], store->fields[i].size);
+  }
+}
+
+int64_t data_store_record_time(const struct data_store_t *store,
+                               const uint64_t *values) {
+  for (unsigned int i = 0; i < store->nr_fields; i++) {
+    if (store->fields[i].type == DATA_STORE_FIELD_TIME) {
+      return values[i];
+    }
+  }
+  return 0;
+}
+
+uint32_t data_store_record_sequence(const struct data_store_t *store,
+                                    const uint64_t *values) {
+  for (unsigned int i = 0; i < store->nr_fields; i++) {
+    if (store->fields[i].type == DATA_STORE_FIELD_SEQUENCE) {
+      return values[i];
+    }
+  }
+  return 0;
+}
+
+bool data_store_fits_buffer(const struct data_store_t *store,
+                            const uint64_t *values,
+                            const struct data_store_buffer_t *buffer) {
+  for (unsigned int i = 0; i < store->nr_fields; i++) {
+    const struct data_store_field_t *field = &store->fields[i];
+    if (field->type == DATA_STORE_FIELD_TIME &&
+        ((int64_t)values[i] < buffer->time_base ||
+         (int64_t)values[i] - buffer->time_base > UINT32_MAX)) {
+      return false;
+    }
+    if (field->type == DATA_STORE_FIELD_SEQUENCE &&
+        (uint32_t)(values[i] - buffer->seq_base) >> field->bits != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void data_store_pack_record(const struct data_store_t *store,
+                            const uint64_t *values,
+                            const struct data_store_buffer_t *buffer,
+                            uint8_t *packed) {
+  memset(packed, 0, store->packed_size);
+  unsigned int pos = 0;
+  for (unsigned int i = 0; i < store->nr_fields; i++) {
+    const struct data_store_field_t *field = &store->fields[i];
+    const unsigned int bits = packed_bits(field);
+    const uint64_t max_value =
+        bits < 64 ? (UINT64_C(1) << bits) - 1 : UINT64_MAX;
+    uint64_t value = values[i];
+    if (field->type == DATA_STORE_FIELD_TIME) {
+      value -= buffer->time_base;
+    } else if (field->type == DATA_STORE_FIELD_SEQUENCE) {
+      value = (uint32_t)(value - buffer->seq_base);
+    } else if (field->type == DATA_STORE_FIELD_UNSIGNED && value > max_value) {
+      value = max_value;
+    }
+    for (unsigned int bit = 0; bit < bits; bit++, pos++) {
+      if ((value >> bit) & 1) {
+        packed[pos / 8] |= 1 << (pos % 8);
+      }
+    }
+  }
+}
+
+void data_store_unpack_record(const struct data_store_t *store,
+                              const uint8_t *packed,
+                              const struct data_store_buffer_t *buffer,
+                              uint64_t *values) {
+  unsigned int pos = 0;
+  for (unsigned int i = 0; i < store->nr_fields; i++) {
+    const struct data_store_field_t *field = &store->fields[i];
+    const unsigned int bits = packed_bits(field);
+    uint64_t value = 0;
+    for (unsigned int bit = 0; bit < bits; bit++, pos++) {
+      value |= (uint64_t)((packed[pos / 8] >> (pos % 8)) & 1) << bit;
+    }
+    if (field->type == DATA_STORE_FIELD_TIME) {
+      value += buffer->time_base;
+    } else if (field->type == DATA_STORE_FIELD_SEQUENCE) {
+      value = (uint32_t)(value + buffer->seq_base);
+    } else if (field->type == DATA_STORE_FIELD_SIGNED) {
+      value = sign_extend(value, bits);
+    }
+    values[i] = value;
+  }
+}
+
+size_t data_store_encode_record(const struct data_store_t *store,
+                                const uint64_t *values, const uint64_t *prev,
+                                uint8_t *out) {
+  uint32_t changed = 0;
+  for (unsigned int i = 0; i < store->nr_fields; i++) {
+    if (values[i] != (prev != NULL ? prev[i] : 0)) {
+      changed |= 1u << i;
+    }
+  }
+  size_t size = write_varint(out, changed);
+  for (unsigned int i = 0; i < store->nr_fields; i++) {
+    if ((changed >> i) & 1 && store->fields[i].type != DATA_STORE_FIELD_BOOL) {
+      const uint64_t delta = values[i] - (prev != NULL ? prev[i] : 0);
+      size += write_varint(out + size, zigzag_encode(delta));
+    }
+  }
+  return size;
+}
+
+size_t data_store_decode_record(const struct data_store_t *store,
+                                const uint8_t *data, size_t size,
+                                const uint64_t *prev, uint64_t *values) {
+  size_t pos = 0;
+  uint64_t changed;
+  if (!read_varint(data, size, &pos, &changed)) {
+    return 0;
+  }
+  for (unsigned int i = 0; i < store->nr_fields; i++) {
+    uint64_t value = prev != NULL ? prev[i] : 0;
+    if ((changed >> i) & 1) {
+      if (store->fields[i].type == DATA_STORE_FIELD_BOOL) {
+        value = !value; // a changed bool is toggled
+      } else {
+        uint64_t delta;
+        if (!read_varint(data, size, &pos, &delta)) {
+          return 0;
+        }
+        value += zigzag_decode(delta);
+      }
+    }
+    values[i] = value;
+  }
+  return pos;
+}
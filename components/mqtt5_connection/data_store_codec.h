@@ -0,0 +1,197 @@
+#ifndef COMPONENTS_MQTT5_CONNECTION_DATA_STORE_CODEC
+#define COMPONENTS_MQTT5_CONNECTION_DATA_STORE_CODEC
+/**
+ * @brief Conversion of records between their representations.
+ *
+ * A record is either a struct given to the data store, a bit packed record in
+ * the RAM buffer or an encoded record in a segment. In between all conversions
+ * the record is an array of field values in the order of the field
+ * descriptions of the store.
+ *
+ * A segment starts with a struct data_store_segment_header_t followed by the
+ * encoded records. The header holds the time range of the records, so
+ * segments can be skipped without decoding them. Each record is encoded
+ * relative to the previous record of the segment, the first one relative to a
+ * record with all fields zero. An encoded record starts with a varint bit mask
+ * of the changed fields. Afterwards the zigzag and varint encoded difference of
+ * each changed integer field follows. Bool fields are fully described by their
+ * bit in the mask.
+ *
+ */
+
+#include "data_store.h"
+
+/** @brief Magic number identifying a segment. */
+#define DATA_STORE_SEGMENT_MAGIC 0x45465331 // "EFS1"
+/** @brief Format of the stored segments. */
+#define DATA_STORE_SEGMENT_FORMAT 2
+
+/**
+ * @brief Header at the start of each segment.
+ *
+ * The magic number and the crc tell segments apart from other files, e.g. the
+ * raw records written by firmware versions before the segments were added.
+ */
+struct data_store_segment_header_t {
+  uint32_t magic;      // DATA_STORE_SEGMENT_MAGIC
+  uint8_t format;      // DATA_STORE_SEGMENT_FORMAT
+  uint8_t stream_id;   // id of the stream, see data_store_stream_id
+  uint8_t reserved[2]; // 0
+  uint32_t nr_records; // number of records in the segment
+  uint32_t crc;        // crc32 of the header with this field set to 0
+  int64_t min_time;    // timestamp of the oldest record
+  int64_t max_time;    // timestamp of the newest record
+};
+
+/** @brief Maximum size of one encoded record in bytes. */
+#define DATA_STORE_MAX_ENCODED_RECORD_SIZE (5 + 10 * DATA_STORE_MAX_FIELDS)
+
+/**
+ * @brief Set the magic number, the format and the crc of a segment header.
+ *
+ * @param header header with all other fields set
+ */
+void data_store_seal_segment_header(struct data_store_segment_header_t *header);
+
+/**
+ * @brief Read the header at the start of a segment.
+ *
+ * @param data start of the segment
+ * @param size number of bytes available at data
+ * @param header output for the header
+ * @return size_t offset of the first record, 0 if the data does not start with
+ * a valid header
+ */
+size_t
+data_store_read_segment_header(const uint8_t *data, size_t size,
+                               struct data_store_segment_header_t *header);
+
+/**
+ * @brief Get the size of a packed record of the store.
+ *
+ * @param store store to check
+ * @return size_t size of a packed record in bytes
+ */
+size_t data_store_packed_size(const struct data_store_t *store);
+
+/**
+ * @brief Get an upper bound of the size of the encoded records.
+ *
+ * The first record of a segment may be larger than this bound, all others are
+ * not.
+ *
+ * @param store store to check
+ * @return size_t upper bound of the size of an encoded record in bytes
+ */
+size_t data_store_max_encoded_size(const struct data_store_t *store);
+
+/**
+ * @brief Read the field values of a record.
+ *
+ * @param store store the record belongs to
+ * @param item record to read
+ * @param values output for store->nr_fields values
+ */
+void data_store_read_fields(const struct data_store_t *store,
+                            const uint8_t *item, uint64_t *values);
+
+/**
+ * @brief Create a record from its field values.
+ *
+ * @param store store the record belongs to
+ * @param values store->nr_fields values
+ * @param item output for the record
+ */
+void data_store_write_fields(const struct data_store_t *store,
+                             const uint64_t *values, uint8_t *item);
+
+/**
+ * @brief Get the timestamp of a record.
+ *
+ * @param store store the record belongs to
+ * @param values field values of the record
+ * @return int64_t value of the first DATA_STORE_FIELD_TIME field, 0 if the
+ * record has no timestamp
+ */
+int64_t data_store_record_time(const struct data_store_t *store,
+                               const uint64_t *values);
+
+/**
+ * @brief Get the sequence number of a record.
+ *
+ * @param store store the record belongs to
+ * @param values field values of the record
+ * @return uint32_t value of the first DATA_STORE_FIELD_SEQUENCE field, 0 if
+ * the record has no sequence number
+ */
+uint32_t data_store_record_sequence(const struct data_store_t *store,
+                                    const uint64_t *values);
+
+/**
+ * @brief Check if a record can be packed relative to the bases of a buffer.
+ *
+ * @param store store the record belongs to
+ * @param values field values of the record
+ * @param buffer buffer holding the bases of the packed values
+ * @return true if all timestamps and sequence numbers fit into the packed
+ * record
+ */
+bool data_store_fits_buffer(const struct data_store_t *store,
+                            const uint64_t *values,
+                            const struct data_store_buffer_t *buffer);
+
+/**
+ * @brief Pack a record for the RAM buffer.
+ *
+ * @param store store the record belongs to
+ * @param values field values of the record
+ * @param buffer buffer holding the bases of the packed values
+ * @param packed output for the packed record of store->packed_size bytes
+ */
+void data_store_pack_record(const struct data_store_t *store,
+                            const uint64_t *values,
+                            const struct data_store_buffer_t *buffer,
+                            uint8_t *packed);
+
+/**
+ * @brief Unpack a record from the RAM buffer.
+ *
+ * @param store store the record belongs to
+ * @param packed packed record of store->packed_size bytes
+ * @param buffer buffer holding the bases of the packed values
+ * @param values output for the field values of the record
+ */
+void data_store_unpack_record(const struct data_store_t *store,
+                              const uint8_t *packed,
+                              const struct data_store_buffer_t *buffer,
+                              uint64_t *values);
+
+/**
+ * @brief Encode one record.
+ *
+ * @param store store the record belongs to
+ * @param values field values of the record
+ * @param prev field values of the previous record, NULL for the first record
+ * @param out output for at least DATA_STORE_MAX_ENCODED_RECORD_SIZE bytes
+ * @return size_t number of bytes written to out
+ */
+size_t data_store_encode_record(const struct data_store_t *store,
+                                const uint64_t *values, const uint64_t *prev,
+                                uint8_t *out);
+
+/**
+ * @brief Decode one record.
+ *
+ * @param store store the record belongs to
+ * @param data encoded data
+ * @param size number of bytes available at data
+ * @param prev field values of the previous record, NULL for the first record
+ * @param values output for the field values of the record
+ * @return size_t number of bytes consumed, 0 if the data does not hold a
+ * complete record
+ */
+size_t data_store_decode_record(const struct data_store_t *store,
+                                const uint8_t *data, size_t size,
+                                const uint64_t *prev, uint64_t *values);
+
+#endif /* COMPONENTS_MQTT5_CONNECTION_DATA_STORE_CODEC */
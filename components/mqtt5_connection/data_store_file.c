@@ -0,0 +1,569 @@
+#include "data_store_backend.h"
+#include "data_store_codec.h"
+
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "esp_vfs.h"
+#include "freertos/semphr.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if CONFIG_MQTT_DATA_LOGGING_BACKEND_LITTLEFS
+#include "esp_littlefs.h"
+#else
+#include "esp_spiffs.h"
+#endif
+
+/**
+ * @brief Storage backend keeping each segment in a file on the storage
+ * partition.
+ *
+ * The partition is mounted with SPIFFS or LittleFS, selected by the
+ * configuration. Only mounting, querying the usage and the garbage collection
+ * differ between both file systems.
+ *
+ * Segment files are named by an increasing file id. A manifest file per stream
+ * holds the ids of the oldest segment and of the next segment to write. So
+ * segments are created and found with a constant number of file system
+ * operations.
+ */
+
+static const char *TAG = "data_store_file";
+
+/** @brief Mount point of the storage partition. */
+#define BASE_PATH "/store"
+/** @brief Label of the storage partition. */
+#define PARTITION_LABEL "storage"
+
+/**
+ * @brief Maximum number of files open at once.
+ *
+ * The writer task, the data logging task and a data query may each access a
+ * segment of a different store.
+ */
+#define MAX_OPEN_FILES 4
+
+#define MAX_FILE_ID 9999
+/** @brief Number of different file ids. */
+#define NR_FILE_IDS (MAX_FILE_ID + 1)
+
+#if CONFIG_MQTT_DATA_LOGGING_BACKEND_LITTLEFS
+/**
+ * @brief Bytes kept free on the partition.
+ *
+ * LittleFS copies a block on write, so it needs free blocks for the manifest
+ * updates.
+ */
+#define MIN_FREE_BYTES (2 * 4096)
+#else
+/**
+ * @brief Bytes kept free on the partition.
+ *
+ * SPIFFS needs free pages for the manifest updates and its garbage collection.
+ */
+#define MIN_FREE_BYTES (8 * CONFIG_SPIFFS_PAGE_SIZE)
+#endif
+
+/** @brief Time after which the usage of the partition is queried again. */
+#define FS_INFO_INTERVAL_US                                                    \
+  ((int64_t)CONFIG_MQTT_DATA_LOGGING_STORAGE_INFO_INTERVAL * 1000000)
+
+/**
+ * @brief Usage of the partition as last queried from the file system.
+ *
+ * Querying the file system walks its metadata. In between two queries the
+ * usage is estimated from the change of the segment bytes counted by the
+ * stores.
+ */
+struct data_store_fs_info_t {
+  size_t total_bytes;    // size of the partition
+  size_t used_bytes;     // used bytes of the partition
+  size_t segment_bytes;  // segment bytes of all stores at the query
+  int64_t query_time_us; // time of the query, 0 if not queried yet
+};
+
+/** @brief Bytes of the segments of all stores. */
+static atomic_size_t segment_bytes_ = 0;
+/** @brief Last queried usage of the partition. */
+static struct data_store_fs_info_t fs_info_;
+/** @brief Mutex protecting fs_info_. */
+static SemaphoreHandle_t fs_info_mutex_ = NULL;
+/** @brief Static buffer for the mutex of fs_info_. */
+static StaticSemaphore_t fs_info_mutex_buffer_;
+
+/** @brief Magic number identifying a valid manifest. */
+#define MANIFEST_MAGIC 0x45464d31 // "EFM1"
+
+/**
+ * @brief Content of the manifest file of a stream.
+ *
+ * Segments with ids from tail_file_id up to (excluding) head_file_id exist on
+ * the disc.
+ */
+struct data_store_manifest_t {
+  uint32_t magic;        // MANIFEST_MAGIC
+  uint16_t tail_file_id; // file id of the oldest segment
+  uint16_t head_file_id; // file id of the next segment to write
+  uint32_t crc;          // crc32 of all fields above
+};
+
+static inline unsigned int next_file_id(unsigned int file_id) {
+  return (file_id + 1) % NR_FILE_IDS;
+}
+
+/**
+ * @brief Set the path of the segment with the given file id.
+ *
+ * @param store store the segment belongs to
+ * @param file_id file id of the segment
+ */
+static inline void set_segment_path(struct data_store_t *store,
+                                    unsigned int file_id) {
+  snprintf(store->path, sizeof(store->path), "%s/%04u.bin", store->dir_path,
+           file_id);
+}
+
+/**
+ * @brief Set the path of the manifest file.
+ *
+ * @param store store the manifest belongs to
+ */
+static inline void set_manifest_path(struct data_store_t *store) {
+  snprintf(store->path, sizeof(store->path), "%s/manifest", store->dir_path);
+}
+
+/**
+ * @brief Write the current segment ids to the manifest file.
+ *
+ * @param store store to save
+ */
+static void data_store_save_manifest_(struct data_store_t *store) {
+  struct data_store_manifest_t manifest = {
+      .magic = MANIFEST_MAGIC,
+      .tail_file_id = store->tail_file_id,
+      .head_file_id = store->head_file_id,
+  };
+  manifest.crc = esp_rom_crc32_le(0, (const uint8_t *)&manifest,
+                                  offsetof(struct data_store_manifest_t, crc));
+  set_manifest_path(store);
+  int fd = open(store->path, O_WRONLY | O_CREAT | O_TRUNC, 0);
+  if (fd < 0) {
+    ESP_LOGE(TAG, "Failed to open file %s, error: %s", store->path,
+             strerror(errno));
+    return;
+  }
+  if (write(fd, &manifest, sizeof(manifest)) != sizeof(manifest)) {
+    ESP_LOGE(TAG, "Failed to write manifest %s", store->path);
+  }
+  close(fd);
+}
+
+/**
+ * @brief Check if a file starts with a valid segment header.
+ *
+ * Files without one are deleted. Those are the raw records written by firmware
+ * versions before the manifest was added, which can not be decoded, or
+ * segments whose header was not completely written.
+ *
+ * @param store store the file belongs to
+ * @param file_id file id of the file
+ * @return true if the file is a segment
+ */
+static bool data_store_check_segment_file_(struct data_store_t *store,
+                                           unsigned int file_id) {
+  set_segment_path(store, file_id);
+  struct data_store_segment_header_t header;
+  uint8_t data[sizeof(header)];
+  int bytes_read = -1;
+  int fd = open(store->path, O_RDONLY);
+  if (fd >= 0) {
+    bytes_read = read(fd, data, sizeof(data));
+    close(fd);
+  }
+  if (bytes_read == sizeof(data) &&
+      data_store_read_segment_header(data, sizeof(data), &header) != 0) {
+    return true;
+  }
+  ESP_LOGW(TAG, "Deleting %s, it is no %s data segment", store->path,
+           store->name);
+  unlink(store->path);
+  return false;
+}
+
+/**
+ * @brief Scan the directory for the oldest and the newest segment.
+ *
+ * Only used to rebuild a missing or corrupt manifest, e.g. at the first mount
+ * after an update from a firmware without manifest. Files which are no segments
+ * are deleted. File ids are assigned in increasing order and wrap around after
+ * MAX_FILE_ID. If the ids on the disc span more than half of the id range, the
+ * ids wrapped around and the oldest segment is the smallest id in the upper
+ * half.
+ *
+ * @param store store to scan
+ */
+static void data_store_scan_segments_(struct data_store_t *store) {
+  store->tail_file_id = 0;
+  store->head_file_id = 0;
+  DIR *root_dir = opendir(store->dir_path);
+  if (!root_dir) {
+    ESP_LOGE(TAG, "Failed to open directory: %s", store->dir_path);
+    return;
+  }
+  const unsigned int half_range = NR_FILE_IDS / 2;
+  unsigned int nr_files = 0;
+  unsigned int min_id = MAX_FILE_ID, max_id = 0;
+  unsigned int min_upper_id = MAX_FILE_ID, max_lower_id = 0;
+  const struct dirent *dir_entry;
+  while ((dir_entry = readdir(root_dir)) != NULL) {
+    unsigned int file_id;
+    if (dir_entry->d_type != DT_REG ||
+        sscanf(dir_entry->d_name, "%4u.bin", &file_id) != 1 ||
+        file_id > MAX_FILE_ID ||
+        !data_store_check_segment_file_(store, file_id)) {
+      continue;
+    }
+    nr_files++;
+    min_id = file_id < min_id ? file_id : min_id;
+    max_id = file_id > max_id ? file_id : max_id;
+    if (file_id >= half_range) {
+      min_upper_id = file_id < min_upper_id ? file_id : min_upper_id;
+    } else {
+      max_lower_id = file_id > max_lower_id ? file_id : max_lower_id;
+    }
+  }
+  closedir(root_dir);
+
+  if (nr_files == 0) {
+    return;
+  }
+  if (max_id - min_id > half_range) {
+    // ids wrapped around
+    store->tail_file_id = min_upper_id;
+    store->head_file_id = next_file_id(max_lower_id);
+  } else {
+    store->tail_file_id = min_id;
+    store->head_file_id = next_file_id(max_id);
+  }
+}
+
+/**
+ * @brief Load the segment ids from the manifest file.
+ *
+ * The directory is only scanned if the manifest is missing or corrupt.
+ *
+ * @param store store to load
+ */
+static void data_store_load_manifest_(struct data_store_t *store) {
+  struct data_store_manifest_t manifest = {0};
+  set_manifest_path(store);
+  int fd = open(store->path, O_RDONLY);
+  if (fd >= 0) {
+    const int bytes_read = read(fd, &manifest, sizeof(manifest));
+    close(fd);
+    if (bytes_read == sizeof(manifest) && manifest.magic == MANIFEST_MAGIC &&
+        manifest.crc ==
+            esp_rom_crc32_le(0, (const uint8_t *)&manifest,
+                             offsetof(struct data_store_manifest_t, crc)) &&
+        manifest.tail_file_id <= MAX_FILE_ID &&
+        manifest.head_file_id <= MAX_FILE_ID) {
+      store->tail_file_id = manifest.tail_file_id;
+      store->head_file_id = manifest.head_file_id;
+      // A segment might be written without updating the manifest afterwards.
+      set_segment_path(store, store->head_file_id);
+      if (access(store->path, F_OK) == 0) {
+        store->head_file_id = next_file_id(store->head_file_id);
+        data_store_save_manifest_(store);
+      }
+      return;
+    }
+  }
+  ESP_LOGW(TAG, "No valid manifest for %s data, scanning directory",
+           store->name);
+  data_store_scan_segments_(store);
+  data_store_save_manifest_(store);
+}
+
+/**
+ * @brief Sum up the size of all segments of a store.
+ *
+ * @param store store to check
+ */
+static void data_store_count_used_bytes_(struct data_store_t *store) {
+  store->used_bytes = 0;
+  for (unsigned int file_id = store->tail_file_id;
+       file_id != store->head_file_id; file_id = next_file_id(file_id)) {
+    struct stat st;
+    set_segment_path(store, file_id);
+    if (stat(store->path, &st) == 0) {
+      store->used_bytes += st.st_size;
+    }
+  }
+  atomic_fetch_add(&segment_bytes_, store->used_bytes);
+}
+
+/**
+ * @brief Query the usage of the partition from the file system.
+ *
+ * @param total_bytes output for the size of the partition
+ * @param used_bytes output for the used bytes of the partition
+ * @return esp_err_t ESP_OK on success
+ */
+static inline esp_err_t data_store_query_fs_info_(size_t *total_bytes,
+                                                  size_t *used_bytes) {
+#if CONFIG_MQTT_DATA_LOGGING_BACKEND_LITTLEFS
+  return esp_littlefs_info(PARTITION_LABEL, total_bytes, used_bytes);
+#else
+  return esp_spiffs_info(PARTITION_LABEL, total_bytes, used_bytes);
+#endif
+}
+
+/**
+ * @brief Get the usage of the partition.
+ *
+ * The file system is only queried if the last query is older than
+ * CONFIG_MQTT_DATA_LOGGING_STORAGE_INFO_INTERVAL seconds or if is_exact is set.
+ * Otherwise the usage is estimated from the last query.
+ *
+ * @param is_exact true to query the file system
+ * @param total_bytes output for the size of the partition
+ * @param used_bytes output for the used bytes of the partition
+ * @return esp_err_t ESP_OK on success
+ */
+static esp_err_t data_store_fs_info_(bool is_exact, size_t *total_bytes,
+                                     size_t *used_bytes) {
+  if (xSemaphoreTake(fs_info_mutex_, portMAX_DELAY) != pdTRUE) {
+    return ESP_ERR_TIMEOUT;
+  }
+  esp_err_t err = ESP_OK;
+  const int64_t now_us = esp_timer_get_time();
+  if (is_exact || fs_info_.query_time_us == 0 ||
+      now_us - fs_info_.query_time_us >= FS_INFO_INTERVAL_US) {
+    size_t total, used;
+    err = data_store_query_fs_info_(&total, &used);
+    if (err == ESP_OK) {
+      fs_info_ = (struct data_store_fs_info_t){
+          .total_bytes = total,
+          .used_bytes = used,
+          .segment_bytes = atomic_load(&segment_bytes_),
+          .query_time_us = now_us,
+      };
+    }
+  }
+  if (err == ESP_OK) {
+    const int64_t used = (int64_t)fs_info_.used_bytes +
+                         (int64_t)atomic_load(&segment_bytes_) -
+                         (int64_t)fs_info_.segment_bytes;
+    *total_bytes = fs_info_.total_bytes;
+    *used_bytes = used > 0 ? used : 0;
+  }
+  xSemaphoreGive(fs_info_mutex_);
+  return err;
+}
+
+/**
+ * @brief Create a directory and its missing parent directories.
+ *
+ * SPIFFS has no directories, there the calls fail without harm.
+ *
+ * @param store store owning the directory
+ */
+static void data_store_make_dirs_(struct data_store_t *store) {
+  snprintf(store->path, sizeof(store->path), "%s", store->dir_path);
+  for (char *sep = strchr(store->path + 1, '/'); sep != NULL;
+       sep = strchr(sep + 1, '/')) {
+    *sep = '\0';
+    mkdir(store->path, 0777);
+    *sep = '/';
+  }
+  mkdir(store->path, 0777);
+}
+
+esp_err_t data_store_backend_mount() {
+#if CONFIG_MQTT_DATA_LOGGING_BACKEND_LITTLEFS
+  const esp_vfs_littlefs_conf_t mount_config = {
+      .base_path = BASE_PATH,
+      .partition_label = PARTITION_LABEL,
+      .format_if_mount_failed = true,
+  };
+  return esp_vfs_littlefs_register(&mount_config);
+#else
+  const esp_vfs_spiffs_conf_t mount_config = {
+      .base_path = BASE_PATH,
+      .partition_label = PARTITION_LABEL,
+      .max_files = MAX_OPEN_FILES,
+      .format_if_mount_failed = true,
+  };
+  return esp_vfs_spiffs_register(&mount_config);
+#endif
+}
+
+void data_store_backend_unmount() {
+#if CONFIG_MQTT_DATA_LOGGING_BACKEND_LITTLEFS
+  esp_vfs_littlefs_unregister(PARTITION_LABEL);
+#else
+  esp_vfs_spiffs_unregister(PARTITION_LABEL);
+#endif
+}
+
+void data_store_backend_idle() {
+#if CONFIG_MQTT_DATA_LOGGING_BACKEND_SPIFFS &&                                 \
+    CONFIG_MQTT_DATA_LOGGING_IDLE_GC_SIZE > 0
+  // Free pages ahead of the next segment writes, so they do not wait for it.
+  const esp_err_t err =
+      esp_spiffs_gc(PARTITION_LABEL, CONFIG_MQTT_DATA_LOGGING_IDLE_GC_SIZE);
+  if (err != ESP_OK && err != ESP_ERR_NOT_FINISHED) {
+    ESP_LOGW(TAG, "SPIFFS garbage collection failed: %s",
+             esp_err_to_name(err));
+  }
+#endif // LittleFS has no separate garbage collection.
+}
+
+void data_store_backend_init(struct data_store_t *store) {
+  if (fs_info_mutex_ == NULL) {
+    fs_info_mutex_ = xSemaphoreCreateMutexStatic(&fs_info_mutex_buffer_);
+  }
+  store->segment_fd = -1;
+  data_store_make_dirs_(store);
+  data_store_load_manifest_(store);
+  data_store_count_used_bytes_(store);
+}
+
+unsigned int data_store_backend_nr_segments(const struct data_store_t *store) {
+  return (store->head_file_id + NR_FILE_IDS - store->tail_file_id) %
+         NR_FILE_IDS;
+}
+
+uint32_t data_store_backend_first_segment(const struct data_store_t *store) {
+  return store->tail_file_id;
+}
+
+uint32_t data_store_backend_next_segment(const struct data_store_t *store,
+                                         uint32_t location) {
+  return next_file_id(location);
+}
+
+uint32_t data_store_backend_head_segment(const struct data_store_t *store) {
+  return store->head_file_id;
+}
+
+bool data_store_backend_begin_segment(struct data_store_t *store,
+                                      size_t max_size) {
+  if (next_file_id(store->head_file_id) == store->tail_file_id) {
+    ESP_LOGE(TAG, "No free file id for %s data", store->name);
+    return false;
+  }
+  set_segment_path(store, store->head_file_id);
+  store->segment_fd = open(store->path, O_RDWR | O_CREAT | O_TRUNC, 0);
+  if (store->segment_fd < 0) {
+    ESP_LOGE(TAG, "Failed to open file %s, error: %s", store->path,
+             strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+bool data_store_backend_append(struct data_store_t *store, const uint8_t *data,
+                               size_t size) {
+  const int written_bytes = write(store->segment_fd, (const char *)data, size);
+  if (written_bytes < 0) {
+    ESP_LOGE(TAG, "Failed to write %s data, error: %s", store->name,
+             strerror(errno));
+    return false;
+  }
+  if (written_bytes != (int)size) {
+    ESP_LOGE(TAG, "Failed to write all %s data, written: %d", store->name,
+             written_bytes);
+    return false;
+  }
+  return true;
+}
+
+bool data_store_backend_end_segment(struct data_store_t *store, bool commit) {
+  struct stat st;
+  if (commit && fstat(store->segment_fd, &st) == 0) {
+    store->used_bytes += st.st_size;
+    atomic_fetch_add(&segment_bytes_, st.st_size);
+  }
+  close(store->segment_fd);
+  store->segment_fd = -1;
+  set_segment_path(store, store->head_file_id);
+  if (!commit) {
+    remove(store->path);
+    return false;
+  }
+  ESP_LOGI(TAG, "%s data written to file %s", store->name, store->path);
+  store->head_file_id = next_file_id(store->head_file_id);
+  data_store_save_manifest_(store);
+  return true;
+}
+
+const uint8_t *data_store_backend_read(struct data_store_t *store,
+                                       uint32_t location, size_t offset,
+                                       size_t max_size, size_t *size) {
+  *size = 0;
+  set_segment_path(store, location);
+  ESP_LOGD(TAG, "Reading %s data from file: %s", store->name, store->path);
+  int fd = open(store->path, O_RDONLY);
+  if (fd < 0) {
+    ESP_LOGE(TAG, "Failed to open file %s, error: %s", store->path,
+             strerror(errno));
+    return NULL;
+  }
+  int bytes_read = -1;
+  if (lseek(fd, offset, SEEK_SET) >= 0) {
+    bytes_read =
+        read(fd, (char *)store->replay_window,
+             max_size < sizeof(store->replay_window)
+                 ? max_size
+                 : sizeof(store->replay_window));
+  }
+  close(fd);
+  if (bytes_read < 0) {
+    return NULL;
+  }
+  *size = bytes_read;
+  return store->replay_window;
+}
+
+void data_store_backend_remove_oldest(struct data_store_t *store) {
+  struct stat st;
+  set_segment_path(store, store->tail_file_id);
+  if (stat(store->path, &st) == 0) {
+    size_t size = st.st_size;
+    if (size > store->used_bytes) {
+      size = store->used_bytes;
+    }
+    store->used_bytes -= size;
+    atomic_fetch_sub(&segment_bytes_, size);
+  }
+  remove(store->path);
+  ESP_LOGD(TAG, "%s data read from file %s", store->name, store->path);
+  store->tail_file_id = next_file_id(store->tail_file_id);
+  data_store_save_manifest_(store);
+}
+
+bool data_store_backend_has_space(const struct data_store_t *store,
+                                  size_t max_size) {
+  size_t total_bytes, used_bytes;
+  if (data_store_fs_info_(false, &total_bytes, &used_bytes) != ESP_OK) {
+    return true; // let the write fail instead of evicting everything
+  }
+  if (used_bytes + max_size + MIN_FREE_BYTES <= total_bytes) {
+    return true;
+  }
+  // Only evict if the partition is really full, the estimate may be off.
+  if (data_store_fs_info_(true, &total_bytes, &used_bytes) != ESP_OK) {
+    return true;
+  }
+  return used_bytes + max_size + MIN_FREE_BYTES <= total_bytes;
+}
+
+esp_err_t data_store_backend_info(size_t *total_bytes, size_t *used_bytes) {
+  return data_store_fs_info_(false, total_bytes, used_bytes);
+}
@@ -0,0 +1,567 @@
+#include "data_store_backend.h"
+
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include <string.h>
+
+/**
+ * @brief Storage backend appending segments to a log on the raw storage
+ * partition.
+ *
+ * The partition is split into one region per stream. The first sector holds
+ * the layout of the regions, written when the partition is formatted. It is
+ * kept as long as the partition is not erased, so the regions never move when
+ * the number of streams changes. Each region is a circular log of records. A
+ * record holds one segment behind a header with a sequence number and a crc
+ * over the header and the segment. The payload is written before the header,
+ * so a record interrupted by a power loss is never valid. Replayed records are
+ * marked as consumed by clearing a word in the header which is not covered by
+ * the crc. On boot the regions are scanned to recover the oldest unconsumed
+ * and the newest record.
+ *
+ * The whole partition is memory mapped, so segments are decoded directly from
+ * the flash.
+ */
+
+static const char *TAG = "data_store_flash_log";
+
+/** @brief Size of a flash sector which is erased at once. */
+#define SECTOR_SIZE 4096
+/** @brief Records start at multiples of this size. */
+#define RECORD_ALIGNMENT 256
+/** @brief Magic number identifying a record header. */
+#define RECORD_MAGIC 0x45464c31 // "EFL1"
+/** @brief Value of the consumed word of an unread record. */
+#define RECORD_NOT_CONSUMED 0xffffffff
+
+/** @brief Magic number identifying the layout of the partition. */
+#define LAYOUT_MAGIC 0x4546504c // "EFPL"
+/** @brief Maximum number of regions of a layout. */
+#define MAX_REGIONS 16
+
+#if CONFIG_MQTT_DATA_LOGGING_BENCHMARK
+// The last region is used by the benchmark.
+#define NR_REGIONS (DATA_STORE_NR_STREAMS + 1)
+#else
+#define NR_REGIONS DATA_STORE_NR_STREAMS
+#endif
+_Static_assert(NR_REGIONS <= MAX_REGIONS, "Too many regions for the layout");
+
+/**
+ * @brief Layout of the regions in the first sector of the partition.
+ *
+ * Regions are indexed by the stream id.
+ */
+struct flash_log_layout_t {
+  uint32_t magic;                       // LAYOUT_MAGIC
+  uint32_t nr_regions;                  // number of regions
+  uint32_t region_size;                 // size of each region in bytes
+  uint32_t region_offsets[MAX_REGIONS]; // offset of each region in bytes
+  uint32_t crc;                         // crc32 of all fields above
+};
+
+/**
+ * @brief Header in front of each record.
+ */
+struct flash_log_header_t {
+  uint32_t magic;      // RECORD_MAGIC
+  uint32_t seq;        // sequence number of the record in the region
+  uint32_t length;     // length of the payload in bytes
+  uint8_t stream_id;   // id of the stream the record belongs to
+  uint8_t reserved[3]; // 0xff
+  uint32_t crc;        // crc32 of payload, seq, length, stream_id, reserved
+  uint32_t consumed;   // RECORD_NOT_CONSUMED until the record is replayed
+};
+
+static const esp_partition_t *partition_ = NULL;
+static const uint8_t *log_data_ = NULL; // memory mapped partition
+static esp_partition_mmap_handle_t mmap_handle_;
+static struct data_store_t *stores_[NR_REGIONS] = {NULL};
+static struct flash_log_layout_t layout_; // layout of the mapped partition
+
+static inline size_t align_up(size_t value, size_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+static inline const struct flash_log_header_t *
+record_header(const struct data_store_t *store, size_t offset) {
+  return (const struct flash_log_header_t *)(log_data_ + store->region_offset +
+                                             offset);
+}
+
+static inline size_t record_size(const struct flash_log_header_t *header) {
+  return align_up(sizeof(struct flash_log_header_t) + header->length,
+                  RECORD_ALIGNMENT);
+}
+
+/**
+ * @brief Complete the crc of a record with the header fields.
+ *
+ * @param header header of the record, the crc field is ignored
+ * @param payload_crc crc32 of the payload
+ * @return uint32_t crc of the record
+ */
+static uint32_t record_crc(const struct flash_log_header_t *header,
+                           uint32_t payload_crc) {
+  return esp_rom_crc32_le(payload_crc, (const uint8_t *)&header->seq,
+                          offsetof(struct flash_log_header_t, crc) -
+                              offsetof(struct flash_log_header_t, seq));
+}
+
+/**
+ * @brief Check if a valid record of the store starts at the offset.
+ *
+ * @param store store owning the region
+ * @param offset offset of the record in the region
+ * @param check_crc also verify the crc of the payload
+ * @return true if the record is valid
+ */
+static bool is_valid_record(const struct data_store_t *store, size_t offset,
+                            bool check_crc) {
+  const struct flash_log_header_t *header = record_header(store, offset);
+  if (offset + sizeof(struct flash_log_header_t) > store->region_size ||
+      header->magic != RECORD_MAGIC || header->stream_id != store->stream_id ||
+      header->length >
+          store->region_size - offset - sizeof(struct flash_log_header_t)) {
+    return false;
+  }
+  return !check_crc ||
+         record_crc(header, esp_rom_crc32_le(0, (const uint8_t *)(header + 1),
+                                             header->length)) == header->crc;
+}
+
+/**
+ * @brief Find the record with the given sequence number.
+ *
+ * The search starts at the offset and wraps around at the end of the region.
+ *
+ * @param store store owning the region
+ * @param start offset to start searching from
+ * @param seq sequence number of the record
+ * @return size_t offset of the record, region_size if it was not found
+ */
+static size_t find_record_(const struct data_store_t *store, size_t start,
+                           uint32_t seq) {
+  for (size_t i = 0; i < store->region_size; i += RECORD_ALIGNMENT) {
+    const size_t offset = (start + i) % store->region_size;
+    if (is_valid_record(store, offset, false) &&
+        record_header(store, offset)->seq == seq) {
+      return offset;
+    }
+  }
+  return store->region_size;
+}
+
+/**
+ * @brief Update the bytes used by the unread records of the region.
+ *
+ * @param store store owning the region
+ */
+static void update_used_bytes_(struct data_store_t *store) {
+  if (store->nr_segments == 0) {
+    store->used_bytes = 0;
+  } else if (store->head_offset > store->tail_offset) {
+    store->used_bytes = store->head_offset - store->tail_offset;
+  } else {
+    store->used_bytes =
+        store->region_size - store->tail_offset + store->head_offset;
+  }
+}
+
+/**
+ * @brief Move the tail to the record following the oldest record.
+ *
+ * @param store store to update
+ */
+static void advance_tail_(struct data_store_t *store) {
+  const struct flash_log_header_t *header =
+      record_header(store, store->tail_offset);
+  const uint32_t next_seq = header->seq + 1;
+  const size_t next_offset =
+      (store->tail_offset + record_size(header)) % store->region_size;
+  store->nr_segments--;
+  if (store->nr_segments == 0) {
+    store->tail_offset = store->head_offset;
+  } else {
+    store->tail_offset = find_record_(store, next_offset, next_seq);
+    if (store->tail_offset >= store->region_size) {
+      ESP_LOGE(TAG, "Lost %u %s segments, record %lu not found",
+               store->nr_segments, store->name, (unsigned long)next_seq);
+      store->nr_segments = 0;
+      store->tail_offset = store->head_offset;
+    }
+  }
+  update_used_bytes_(store);
+}
+
+/**
+ * @brief Erase the flash in front of the head up to the given offset.
+ *
+ * Unread records in the erased sectors are dropped.
+ *
+ * @param store store owning the region
+ * @param end offset up to which the flash needs to be erased
+ * @return true if the flash is erased
+ */
+static bool erase_up_to_(struct data_store_t *store, size_t end) {
+  while (store->erased_end < end) {
+    const size_t sector = store->erased_end;
+    while (store->nr_segments > 0 &&
+           store->tail_offset < sector + SECTOR_SIZE &&
+           store->tail_offset +
+                   record_size(record_header(store, store->tail_offset)) >
+               sector) {
+      ESP_LOGW(TAG, "Region of %s data full, dropping oldest segment",
+               store->name);
+      data_store_reset_replay(store);
+      advance_tail_(store);
+      store->nr_evicted++;
+    }
+    esp_err_t err = esp_partition_erase_range(
+        partition_, store->region_offset + sector, SECTOR_SIZE);
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Failed to erase sector of %s data: %s", store->name,
+               esp_err_to_name(err));
+      return false;
+    }
+    store->erased_end += SECTOR_SIZE;
+  }
+  return true;
+}
+
+/**
+ * @brief Scan the region for the records left from a previous run.
+ *
+ * @param store store owning the region
+ */
+static void data_store_scan_region_(struct data_store_t *store) {
+  bool found_record = false;
+  uint32_t max_seq = 0, min_unconsumed_seq = UINT32_MAX;
+  size_t head_offset = 0;
+  size_t offset = 0;
+  while (offset < store->region_size) {
+    if (!is_valid_record(store, offset, true)) {
+      offset += RECORD_ALIGNMENT;
+      continue;
+    }
+    const struct flash_log_header_t *header = record_header(store, offset);
+    if (!found_record || header->seq >= max_seq) {
+      found_record = true;
+      max_seq = header->seq;
+      head_offset = offset + record_size(header);
+    }
+    if (header->consumed == RECORD_NOT_CONSUMED) {
+      store->nr_segments++;
+      if (header->seq < min_unconsumed_seq) {
+        min_unconsumed_seq = header->seq;
+        store->tail_offset = offset;
+      }
+    }
+    offset += record_size(header);
+  }
+  // The sector behind the newest record may hold an interrupted record.
+  store->head_offset = align_up(head_offset, SECTOR_SIZE) % store->region_size;
+  store->erased_end = store->head_offset;
+  store->next_seq = found_record ? max_seq + 1 : 0;
+  if (store->nr_segments == 0) {
+    store->tail_offset = store->head_offset;
+  }
+  update_used_bytes_(store);
+}
+
+static inline uint32_t layout_crc(const struct flash_log_layout_t *layout) {
+  return esp_rom_crc32_le(0, (const uint8_t *)layout,
+                          offsetof(struct flash_log_layout_t, crc));
+}
+
+/**
+ * @brief Check if the layout is intact and its regions fit the partition.
+ *
+ * @param layout layout to check
+ * @return true if the layout can be used
+ */
+static bool is_valid_layout(const struct flash_log_layout_t *layout) {
+  if (layout->magic != LAYOUT_MAGIC || layout->crc != layout_crc(layout) ||
+      layout->nr_regions > MAX_REGIONS || layout->region_size == 0 ||
+      layout->region_size % SECTOR_SIZE != 0) {
+    return false;
+  }
+  for (unsigned int i = 0; i < layout->nr_regions; i++) {
+    const uint32_t offset = layout->region_offsets[i];
+    if (offset < SECTOR_SIZE || offset % SECTOR_SIZE != 0 ||
+        offset + layout->region_size > partition_->size) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Erase the partition and write a new layout to it.
+ *
+ * The regions are laid out for the streams of this firmware. All data on the
+ * partition is lost, including the files of a former filesystem backend.
+ *
+ * @return true if the partition is formatted
+ */
+static bool format_partition_() {
+  ESP_LOGW(TAG, "No valid layout on the storage partition, formatting it");
+  esp_err_t err = esp_partition_erase_range(partition_, 0, partition_->size);
+  if (err == ESP_OK) {
+    layout_ = (struct flash_log_layout_t){
+        .magic = LAYOUT_MAGIC,
+        .nr_regions = NR_REGIONS,
+        .region_size = (partition_->size - SECTOR_SIZE) / NR_REGIONS /
+                       SECTOR_SIZE * SECTOR_SIZE,
+    };
+    for (unsigned int i = 0; i < NR_REGIONS; i++) {
+      layout_.region_offsets[i] = SECTOR_SIZE + i * layout_.region_size;
+    }
+    layout_.crc = layout_crc(&layout_);
+    err = esp_partition_write(partition_, 0, &layout_, sizeof(layout_));
+  }
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to format storage partition: %s",
+             esp_err_to_name(err));
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Find and map the storage partition and load its layout.
+ *
+ * The partition is formatted if it holds no valid layout, e.g. at the first
+ * start with this backend.
+ *
+ * @return true if the partition is mapped
+ */
+static bool map_partition_() {
+  if (log_data_ != NULL) {
+    return true;
+  }
+  partition_ = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                        ESP_PARTITION_SUBTYPE_ANY, "storage");
+  if (partition_ == NULL) {
+    ESP_LOGE(TAG, "Storage partition not found");
+    return false;
+  }
+  const void *data;
+  esp_err_t err = esp_partition_mmap(partition_, 0, partition_->size,
+                                     ESP_PARTITION_MMAP_DATA, &data,
+                                     &mmap_handle_);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to map storage partition: %s", esp_err_to_name(err));
+    return false;
+  }
+  memcpy(&layout_, data, sizeof(layout_));
+  if (!is_valid_layout(&layout_) && !format_partition_()) {
+    esp_partition_munmap(mmap_handle_);
+    return false;
+  }
+  log_data_ = data;
+  return true;
+}
+
+esp_err_t data_store_backend_mount() {
+  // The partition is mapped when the first store is initialized.
+  return ESP_OK;
+}
+
+void data_store_backend_unmount() {}
+
+void data_store_backend_idle() {
+  // Sectors are erased right before they are written.
+}
+
+void data_store_backend_init(struct data_store_t *store) {
+  store->region_size = 0;
+  store->tail_offset = 0;
+  store->head_offset = 0;
+  store->erased_end = 0;
+  store->next_seq = 0;
+  store->nr_segments = 0;
+  store->used_bytes = 0;
+  if (store->stream_id >= NR_REGIONS) {
+    ESP_LOGE(TAG, "No region for stream %u", store->stream_id);
+    return;
+  }
+  if (!map_partition_()) {
+    return;
+  }
+  if (store->stream_id >= layout_.nr_regions) {
+    // Moving the regions would lose their data, so only a new partition gets
+    // a region for a new stream.
+    ESP_LOGE(TAG,
+             "No region for %s data in the storage layout, erase the "
+             "partition to add it",
+             store->name);
+    return;
+  }
+  store->region_offset = layout_.region_offsets[store->stream_id];
+  store->region_size = layout_.region_size;
+  stores_[store->stream_id] = store;
+  data_store_scan_region_(store);
+}
+
+unsigned int data_store_backend_nr_segments(const struct data_store_t *store) {
+  return store->nr_segments;
+}
+
+uint32_t data_store_backend_first_segment(const struct data_store_t *store) {
+  return store->tail_offset;
+}
+
+uint32_t data_store_backend_next_segment(const struct data_store_t *store,
+                                         uint32_t location) {
+  const struct flash_log_header_t *header = record_header(store, location);
+  return find_record_(
+      store, (location + record_size(header)) % store->region_size,
+      header->seq + 1);
+}
+
+uint32_t data_store_backend_head_segment(const struct data_store_t *store) {
+  return store->head_offset;
+}
+
+bool data_store_backend_begin_segment(struct data_store_t *store,
+                                      size_t max_size) {
+  const size_t max_size_on_flash =
+      align_up(sizeof(struct flash_log_header_t) + max_size, RECORD_ALIGNMENT);
+  if (max_size_on_flash > store->region_size) {
+    ESP_LOGE(TAG, "Segment of %s data does not fit into the region",
+             store->name);
+    return false;
+  }
+  if (store->head_offset + max_size_on_flash > store->region_size) {
+    // Records never wrap around the end of the region.
+    store->head_offset = 0;
+    store->erased_end = 0;
+  }
+  if (!erase_up_to_(store, store->head_offset + max_size_on_flash)) {
+    return false;
+  }
+  store->write_size = 0;
+  store->write_crc = 0;
+  return true;
+}
+
+bool data_store_backend_append(struct data_store_t *store, const uint8_t *data,
+                               size_t size) {
+  esp_err_t err = esp_partition_write(
+      partition_,
+      store->region_offset + store->head_offset +
+          sizeof(struct flash_log_header_t) + store->write_size,
+      data, size);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to write %s data: %s", store->name,
+             esp_err_to_name(err));
+    return false;
+  }
+  store->write_crc = esp_rom_crc32_le(store->write_crc, data, size);
+  store->write_size += size;
+  return true;
+}
+
+bool data_store_backend_end_segment(struct data_store_t *store, bool commit) {
+  esp_err_t err = ESP_FAIL;
+  struct flash_log_header_t header = {
+      .magic = RECORD_MAGIC,
+      .seq = store->next_seq,
+      .length = store->write_size,
+      .stream_id = store->stream_id,
+      .reserved = {0xff, 0xff, 0xff},
+      .consumed = RECORD_NOT_CONSUMED,
+  };
+  if (commit) {
+    header.crc = record_crc(&header, store->write_crc);
+    // The header is written last and validates the record.
+    err = esp_partition_write(partition_,
+                              store->region_offset + store->head_offset,
+                              &header, sizeof(header));
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Failed to write header of %s data: %s", store->name,
+               esp_err_to_name(err));
+    }
+  }
+  if (err != ESP_OK) {
+    // The partly written flash is skipped up to the next sector, like the scan
+    // does after a power loss. Erasing its sector would drop the records in
+    // front of it. The next segment erases the following sector as usual.
+    store->head_offset =
+        align_up(store->head_offset + sizeof(header) + store->write_size,
+                 SECTOR_SIZE) %
+        store->region_size;
+    store->erased_end = store->head_offset;
+    if (store->nr_segments == 0) {
+      store->tail_offset = store->head_offset;
+    }
+    return false;
+  }
+  ESP_LOGI(TAG, "%s data written to record %lu", store->name,
+           (unsigned long)store->next_seq);
+  if (store->nr_segments == 0) {
+    store->tail_offset = store->head_offset;
+  }
+  store->head_offset += align_up(sizeof(header) + header.length,
+                                 RECORD_ALIGNMENT);
+  store->next_seq++;
+  store->nr_segments++;
+  update_used_bytes_(store);
+  return true;
+}
+
+const uint8_t *data_store_backend_read(struct data_store_t *store,
+                                       uint32_t location, size_t offset,
+                                       size_t max_size, size_t *size) {
+  *size = 0;
+  if (store->nr_segments == 0 || !is_valid_record(store, location, false)) {
+    return NULL;
+  }
+  const struct flash_log_header_t *header = record_header(store, location);
+  if (offset < header->length) {
+    *size = header->length - offset < max_size ? header->length - offset
+                                               : max_size;
+  }
+  return (const uint8_t *)(header + 1) + offset;
+}
+
+void data_store_backend_remove_oldest(struct data_store_t *store) {
+  if (store->nr_segments == 0) {
+    return;
+  }
+  const uint32_t consumed = 0;
+  esp_err_t err = esp_partition_write(
+      partition_,
+      store->region_offset + store->tail_offset +
+          offsetof(struct flash_log_header_t, consumed),
+      &consumed, sizeof(consumed));
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to mark %s data as consumed: %s", store->name,
+             esp_err_to_name(err));
+  }
+  ESP_LOGD(TAG, "%s data read from record %lu", store->name,
+           (unsigned long)record_header(store, store->tail_offset)->seq);
+  advance_tail_(store);
+}
+
+bool data_store_backend_has_space(const struct data_store_t *store,
+                                  size_t max_size) {
+  // Each stream has its own region which drops its oldest records if full.
+  return true;
+}
+
+esp_err_t data_store_backend_info(size_t *total_bytes, size_t *used_bytes) {
+  if (partition_ == NULL) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  *total_bytes = partition_->size;
+  *used_bytes = 0;
+  for (unsigned int i = 0; i < NR_REGIONS; i++) {
+    if (stores_[i] != NULL) {
+      *used_bytes += stores_[i]->used_bytes;
+    }
+  }
+  return ESP_OK;
+}
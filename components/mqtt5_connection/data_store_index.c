@@ -0,0 +1,263 @@
+#include "data_store_index.h"
+#include "data_store_backend.h"
+#include "data_store_codec.h"
+
+#include "esp_log.h"
+
+static const char *TAG = "data_store_index";
+
+/**
+ * @brief State of a running query.
+ */
+struct data_store_query_t {
+  time_t from;                     // start of the time window, inclusive
+  time_t to;                       // end of the time window, inclusive
+  unsigned int max_records;        // maximum number of passed records
+  unsigned int nr_records;         // number of passed records
+  data_store_record_cb_t callback; // called for each record
+  void *context;                   // passed to the callback
+  const uint32_t *after_seq;       // skip records up to it, NULL for none
+  uint32_t *last_seq;              // output for the last passed record
+  // record passed to the callback
+  uint64_t item[DATA_STORE_MAX_ITEM_SIZE / sizeof(uint64_t)];
+};
+
+/**
+ * @brief Drop the entries of segments which were removed from the storage.
+ *
+ * @param store store to update
+ */
+static void data_store_index_trim_(struct data_store_t *store) {
+  const unsigned int nr_segments = data_store_backend_nr_segments(store);
+  while (store->index_count > nr_segments) {
+    store->index_tail = (store->index_tail + 1) % DATA_STORE_INDEX_SIZE;
+    store->index_count--;
+  }
+}
+
+void data_store_index_add(struct data_store_t *store,
+                          const struct data_store_index_entry_t *entry) {
+  data_store_index_trim_(store);
+  if (store->index_count == DATA_STORE_INDEX_SIZE) {
+    store->index_tail = (store->index_tail + 1) % DATA_STORE_INDEX_SIZE;
+    store->index_count--;
+  }
+  store->index[(store->index_tail + store->index_count) %
+               DATA_STORE_INDEX_SIZE] = *entry;
+  store->index_count++;
+}
+
+bool data_store_index_oldest_time(struct data_store_t *store,
+                                  int64_t *oldest_time) {
+  data_store_index_trim_(store);
+  const unsigned int nr_segments = data_store_backend_nr_segments(store);
+  if (nr_segments == 0) {
+    return false;
+  }
+  if (store->index_count == nr_segments) {
+    *oldest_time = store->index[store->index_tail].min_time;
+    return true;
+  }
+  struct data_store_segment_header_t header;
+  size_t size;
+  const uint8_t *data = data_store_backend_read(
+      store, data_store_backend_first_segment(store), 0,
+      sizeof(struct data_store_segment_header_t), &size);
+  if (data == NULL ||
+      data_store_read_segment_header(data, size, &header) == 0) {
+    return false;
+  }
+  *oldest_time = header.min_time;
+  return true;
+}
+
+void data_store_index_init(struct data_store_t *store) {
+  store->index_tail = 0;
+  store->index_count = 0;
+  const unsigned int nr_segments = data_store_backend_nr_segments(store);
+  uint32_t location = data_store_backend_first_segment(store);
+  for (unsigned int i = 0; i < nr_segments; i++) {
+    if (i > 0) {
+      location = data_store_backend_next_segment(store, location);
+    }
+    struct data_store_segment_header_t header;
+    size_t size;
+    const uint8_t *data = data_store_backend_read(
+        store, location, 0, sizeof(struct data_store_segment_header_t), &size);
+    if (data == NULL ||
+        data_store_read_segment_header(data, size, &header) == 0) {
+      // Unreadable segments are never skipped by a query.
+      header.min_time = INT64_MIN;
+      header.max_time = INT64_MAX;
+    }
+    data_store_index_add(store,
+                         &(struct data_store_index_entry_t){
+                             .min_time = header.min_time,
+                             .max_time = header.max_time,
+                             .location = location,
+                         });
+  }
+}
+
+/**
+ * @brief Pass a record to the callback if it is in the time window and behind
+ * the cursor.
+ *
+ * The sequence numbers increase in the order the records are stored, even if
+ * the timestamps do not, e.g. before the time synchronization. They may wrap
+ * around, so they are compared by their difference.
+ *
+ * @param store store the record belongs to
+ * @param query running query
+ * @param values field values of the record
+ * @return false if the record was not passed because max_records was reached
+ */
+static bool data_store_query_record_(const struct data_store_t *store,
+                                     struct data_store_query_t *query,
+                                     const uint64_t *values) {
+  const time_t time = data_store_record_time(store, values);
+  if (time < query->from || time > query->to) {
+    return true;
+  }
+  const uint32_t seq = data_store_record_sequence(store, values);
+  if (query->after_seq != NULL && (int32_t)(seq - *query->after_seq) <= 0) {
+    return true;
+  }
+  if (query->nr_records >= query->max_records) {
+    return false;
+  }
+  data_store_write_fields(store, values, (uint8_t *)query->item);
+  query->callback(query->item, query->context);
+  query->nr_records++;
+  *query->last_seq = seq;
+  return true;
+}
+
+/**
+ * @brief Pass the records of a segment in the time window to the callback.
+ *
+ * @param store store owning the segment
+ * @param query running query
+ * @param location location of the segment
+ * @return false if max_records was reached
+ */
+static bool data_store_query_segment_(struct data_store_t *store,
+                                      struct data_store_query_t *query,
+                                      uint32_t location) {
+  uint64_t values[2][DATA_STORE_MAX_FIELDS];
+  unsigned int nr_decoded = 0;
+  size_t offset = 0;
+  while (1) {
+    size_t size;
+    const uint8_t *data = data_store_backend_read(
+        store, location, offset, DATA_STORE_REPLAY_WINDOW_SIZE, &size);
+    if (data == NULL || size == 0) {
+      return true;
+    }
+    size_t pos = 0;
+    if (offset == 0) {
+      struct data_store_segment_header_t header;
+      pos = data_store_read_segment_header(data, size, &header);
+      if (pos == 0) {
+        ESP_LOGE(TAG, "Unknown format of %s data segment", store->name);
+        return true;
+      }
+      if (header.max_time < query->from || header.min_time > query->to) {
+        return true;
+      }
+    }
+    size_t encoded_size;
+    while ((encoded_size = data_store_decode_record(
+                store, data + pos, size - pos,
+                nr_decoded > 0 ? values[(nr_decoded + 1) % 2] : NULL,
+                values[nr_decoded % 2])) > 0) {
+      pos += encoded_size;
+      if (!data_store_query_record_(store, query, values[nr_decoded % 2])) {
+        return false;
+      }
+      nr_decoded++;
+    }
+    if (pos == 0) {
+      return true; // incomplete segment
+    }
+    offset += pos;
+  }
+}
+
+/**
+ * @brief Pass the records of a RAM buffer in the time window to the callback.
+ *
+ * Needs to be called with the mutex taken.
+ *
+ * @param store store owning the buffer
+ * @param query running query
+ * @param buffer buffer to read
+ * @return false if max_records was reached
+ */
+static bool data_store_query_buffer_(const struct data_store_t *store,
+                                     struct data_store_query_t *query,
+                                     const struct data_store_buffer_t *buffer) {
+  if (buffer->count == 0 || buffer->max_time < query->from ||
+      buffer->time_base > query->to) {
+    return true;
+  }
+  uint64_t values[DATA_STORE_MAX_FIELDS];
+  for (unsigned int i = 0; i < buffer->count; i++) {
+    const unsigned int index = (buffer->tail + i) % store->capacity;
+    data_store_unpack_record(store, buffer->items + index * store->packed_size,
+                             buffer, values);
+    if (!data_store_query_record_(store, query, values)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool data_store_query(struct data_store_t *store, time_t from, time_t to,
+                      const uint32_t *after_seq, unsigned int max_records,
+                      data_store_record_cb_t callback, void *context,
+                      uint32_t *last_seq) {
+  struct data_store_query_t query = {
+      .from = from,
+      .to = to,
+      .max_records = max_records,
+      .callback = callback,
+      .context = context,
+      .after_seq = after_seq,
+      .last_seq = last_seq,
+  };
+  if (xSemaphoreTake(store->storage_mutex, portMAX_DELAY) != pdTRUE) {
+    return false;
+  }
+  data_store_index_trim_(store);
+  const unsigned int nr_segments = data_store_backend_nr_segments(store);
+  const unsigned int nr_unindexed = nr_segments - store->index_count;
+  bool is_complete = true;
+  // Segments older than the index need to be checked by their header.
+  uint32_t location = data_store_backend_first_segment(store);
+  for (unsigned int i = 0; i < nr_unindexed && is_complete; i++) {
+    if (i > 0) {
+      location = data_store_backend_next_segment(store, location);
+    }
+    is_complete = data_store_query_segment_(store, &query, location);
+  }
+  for (unsigned int i = 0; i < store->index_count && is_complete; i++) {
+    const struct data_store_index_entry_t *entry =
+        &store->index[(store->index_tail + i) % DATA_STORE_INDEX_SIZE];
+    if (entry->max_time >= from && entry->min_time <= to) {
+      is_complete = data_store_query_segment_(store, &query, entry->location);
+    }
+  }
+  if (is_complete && xSemaphoreTake(store->mutex, portMAX_DELAY) == pdTRUE) {
+    // The pending buffer is older than the active buffer.
+    is_complete =
+        (!store->is_pending ||
+         data_store_query_buffer_(store, &query,
+                                  &store->buffers[store->active ^ 1])) &&
+        data_store_query_buffer_(store, &query,
+                                 &store->buffers[store->active]);
+    xSemaphoreGive(store->mutex);
+  }
+  xSemaphoreGive(store->storage_mutex);
+  return is_complete;
+}
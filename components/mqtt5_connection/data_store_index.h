@@ -0,0 +1,44 @@
+#ifndef COMPONENTS_MQTT5_CONNECTION_DATA_STORE_INDEX
+#define COMPONENTS_MQTT5_CONNECTION_DATA_STORE_INDEX
+/**
+ * @brief Index of the time ranges of the segments on the storage.
+ *
+ * The index holds the newest DATA_STORE_INDEX_SIZE segments of a store. Since
+ * segments are only removed oldest first, the index is reconciled with the
+ * storage by the number of segments. All functions are called with the storage
+ * mutex of the store taken.
+ *
+ */
+
+#include "data_store.h"
+
+/**
+ * @brief Build the index from the headers of the segments on the storage.
+ *
+ * @param store store to index
+ */
+void data_store_index_init(struct data_store_t *store);
+
+/**
+ * @brief Add the newest segment to the index.
+ *
+ * @param store store the segment was written to
+ * @param entry time range and location of the segment
+ */
+void data_store_index_add(struct data_store_t *store,
+                          const struct data_store_index_entry_t *entry);
+
+/**
+ * @brief Get the timestamp of the oldest record on the storage.
+ *
+ * Reads the header of the oldest segment if it dropped out of the index.
+ * Needs to be called with the storage mutex taken.
+ *
+ * @param store store to check
+ * @param oldest_time output for the timestamp
+ * @return true if the store has a segment on the storage
+ */
+bool data_store_index_oldest_time(struct data_store_t *store,
+                                  int64_t *oldest_time);
+
+#endif /* COMPONENTS_MQTT5_CONNECTION_DATA_STORE_INDEX */
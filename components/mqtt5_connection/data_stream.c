@@ -0,0 +1,393 @@
+#include "data_stream.h"
+
+#include "data_logging.h"
+#include "data_rollup.h"
+#include "mqtt5_connection.h"
+
+#include <string.h>
+
+/** @brief Record type stored by all streams. */
+#define RECORD struct data_logging_record_t
+
+#if CONFIG_MQTT_DATA_LOGGING_PUMP_RAW_EVENTS
+#define IS_PUMP_ROLLUP_ONLY false
+#define PUMP_DATA_BUFFER_SIZE                                                  \
+  DATA_STORE_BUFFER_SIZE(CONFIG_MQTT_DATA_LOGGING_PUMP_STORE_SIZE_MULTIPLE)
+#else
+#define IS_PUMP_ROLLUP_ONLY true
+// Raw events are not logged, they only feed the rollups. The store only exists
+// because every stream has one, so it gets the smallest buffer.
+#define PUMP_DATA_BUFFER_SIZE DATA_STORE_BUFFER_SIZE(2)
+#endif
+#define PUMP_DATA_QUOTA (CONFIG_MQTT_DATA_LOGGING_PUMP_STORE_QUOTA_KB * 1024)
+#define PUMP_CYCLE_DATA_BUFFER_SIZE                                            \
+  DATA_STORE_BUFFER_SIZE(                                                      \
+      CONFIG_MQTT_DATA_LOGGING_PUMP_CYCLE_STORE_SIZE_MULTIPLE)
+#define PUMP_CYCLE_DATA_QUOTA                                                  \
+  (CONFIG_MQTT_DATA_LOGGING_PUMP_CYCLE_STORE_QUOTA_KB * 1024)
+#define LIGHT_DATA_BUFFER_SIZE                                                 \
+  DATA_STORE_BUFFER_SIZE(CONFIG_MQTT_DATA_LOGGING_LIGHT_STORE_SIZE_MULTIPLE)
+#define LIGHT_DATA_QUOTA (CONFIG_MQTT_DATA_LOGGING_LIGHT_STORE_QUOTA_KB * 1024)
+#define MEMORY_DATA_BUFFER_SIZE                                                \
+  DATA_STORE_BUFFER_SIZE(CONFIG_MQTT_DATA_LOGGING_MEMORY_STORE_SIZE_MULTIPLE)
+#define MEMORY_DATA_QUOTA                                                      \
+  (CONFIG_MQTT_DATA_LOGGING_MEMORY_STORE_QUOTA_KB * 1024)
+#define ROLLUP_DATA_BUFFER_SIZE                                                \
+  DATA_STORE_BUFFER_SIZE(CONFIG_MQTT_DATA_LOGGING_ROLLUP_STORE_SIZE_MULTIPLE)
+#define ROLLUP_DATA_QUOTA                                                      \
+  (CONFIG_MQTT_DATA_LOGGING_ROLLUP_STORE_QUOTA_KB * 1024)
+
+#if CONFIG_MQTT_DATA_LOGGING_LIGHT_COMPRESSION_DEADBAND
+#define LIGHT_COMPRESSION DATA_COMPRESSION_DEADBAND
+#elif CONFIG_MQTT_DATA_LOGGING_LIGHT_COMPRESSION_SWINGING_DOOR
+#define LIGHT_COMPRESSION DATA_COMPRESSION_SWINGING_DOOR
+#else
+#define LIGHT_COMPRESSION DATA_COMPRESSION_NONE
+#endif
+
+#if CONFIG_MQTT_DATA_LOGGING_MEMORY_COMPRESSION_DEADBAND
+#define MEMORY_COMPRESSION DATA_COMPRESSION_DEADBAND
+#elif CONFIG_MQTT_DATA_LOGGING_MEMORY_COMPRESSION_SWINGING_DOOR
+#define MEMORY_COMPRESSION DATA_COMPRESSION_SWINGING_DOOR
+#else
+#define MEMORY_COMPRESSION DATA_COMPRESSION_NONE
+#endif
+
+// The order of the fields is persisted with the segments. Only append new
+// fields, they decode as 0 from older segments.
+
+static const struct data_store_field_t pump_data_fields_[] = {
+    DATA_STORE_FIELD(RECORD, timestamp, DATA_STORE_FIELD_TIME, 32),
+    DATA_STORE_FIELD(RECORD, pump_on, DATA_STORE_FIELD_BOOL, 1),
+    DATA_STORE_FIELD(RECORD, seq, DATA_STORE_FIELD_SEQUENCE, 16),
+    DATA_STORE_FIELD(RECORD, boot_id, DATA_STORE_FIELD_UNSIGNED, 16),
+    DATA_STORE_FIELD(RECORD, clock_unsynced, DATA_STORE_FIELD_BOOL, 1),
+};
+
+DATA_STORE_DEFINE(pump_data_store_, "pump", DATA_STORE_STREAM_PUMP, RECORD,
+                  pump_data_fields_, "/store/log_data/pump",
+                  PUMP_DATA_BUFFER_SIZE, PUMP_DATA_QUOTA);
+
+static const struct data_store_field_t light_data_fields_[] = {
+    DATA_STORE_FIELD(RECORD, timestamp, DATA_STORE_FIELD_TIME, 32),
+    DATA_STORE_PUBLISHED_FIELD(RECORD, intensity, DATA_STORE_FIELD_UNSIGNED,
+                               16, "intensity", DATA_STORE_JSON_NUMBER),
+    DATA_STORE_FIELD(RECORD, seq, DATA_STORE_FIELD_SEQUENCE, 16),
+    DATA_STORE_FIELD(RECORD, boot_id, DATA_STORE_FIELD_UNSIGNED, 16),
+    DATA_STORE_FIELD(RECORD, clock_unsynced, DATA_STORE_FIELD_BOOL, 1),
+};
+
+DATA_STORE_DEFINE(light_data_store_, "light", DATA_STORE_STREAM_LIGHT, RECORD,
+                  light_data_fields_, "/store/log_data/light",
+                  LIGHT_DATA_BUFFER_SIZE, LIGHT_DATA_QUOTA);
+
+/** @brief Compressed fields of the light records. */
+static const struct data_compression_field_t light_compression_fields_[] = {
+    DATA_COMPRESSION_FIELD(intensity, false,
+                           CONFIG_MQTT_DATA_LOGGING_LIGHT_TOLERANCE),
+};
+DATA_COMPRESSION_DEFINE(light_compression_, LIGHT_COMPRESSION,
+                        light_compression_fields_,
+                        CONFIG_MQTT_DATA_LOGGING_COMPRESSION_MAX_INTERVAL);
+
+static const struct data_store_field_t memory_data_fields_[] = {
+    DATA_STORE_FIELD(RECORD, timestamp, DATA_STORE_FIELD_TIME, 32),
+    DATA_STORE_PUBLISHED_FIELD(RECORD, memory.free_heap_size,
+                               DATA_STORE_FIELD_UNSIGNED, 32,
+                               "free_heap_size", DATA_STORE_JSON_NUMBER),
+    DATA_STORE_PUBLISHED_FIELD(RECORD, memory.min_free_heap_size,
+                               DATA_STORE_FIELD_UNSIGNED, 32,
+                               "min_free_heap_size", DATA_STORE_JSON_NUMBER),
+    DATA_STORE_PUBLISHED_FIELD(RECORD, memory.store_used_bytes,
+                               DATA_STORE_FIELD_UNSIGNED, 32,
+                               "store_used_bytes", DATA_STORE_JSON_NUMBER),
+    DATA_STORE_FIELD(RECORD, seq, DATA_STORE_FIELD_SEQUENCE, 16),
+    DATA_STORE_FIELD(RECORD, boot_id, DATA_STORE_FIELD_UNSIGNED, 16),
+    DATA_STORE_FIELD(RECORD, clock_unsynced, DATA_STORE_FIELD_BOOL, 1),
+    DATA_STORE_PUBLISHED_FIELD(RECORD, memory.largest_free_block,
+                               DATA_STORE_FIELD_UNSIGNED, 32,
+                               "largest_free_block", DATA_STORE_JSON_NUMBER),
+    DATA_STORE_PUBLISHED_FIELD(RECORD, memory.rssi, DATA_STORE_FIELD_SIGNED, 8,
+                               "rssi", DATA_STORE_JSON_NONZERO),
+};
+
+DATA_STORE_DEFINE(memory_data_store_, "memory", DATA_STORE_STREAM_MEMORY,
+                  RECORD, memory_data_fields_, "/store/log_data/mem",
+                  MEMORY_DATA_BUFFER_SIZE, MEMORY_DATA_QUOTA);
+
+/** @brief Compressed fields of the memory records. */
+static const struct data_compression_field_t memory_compression_fields_[] = {
+    DATA_COMPRESSION_FIELD(memory.free_heap_size, false,
+                           CONFIG_MQTT_DATA_LOGGING_MEMORY_HEAP_TOLERANCE),
+    DATA_COMPRESSION_FIELD(memory.min_free_heap_size, false,
+                           CONFIG_MQTT_DATA_LOGGING_MEMORY_HEAP_TOLERANCE),
+    DATA_COMPRESSION_FIELD(memory.largest_free_block, false,
+                           CONFIG_MQTT_DATA_LOGGING_MEMORY_HEAP_TOLERANCE),
+    DATA_COMPRESSION_FIELD(memory.rssi, true,
+                           CONFIG_MQTT_DATA_LOGGING_MEMORY_RSSI_TOLERANCE),
+};
+DATA_COMPRESSION_DEFINE(memory_compression_, MEMORY_COMPRESSION,
+                        memory_compression_fields_,
+                        CONFIG_MQTT_DATA_LOGGING_COMPRESSION_MAX_INTERVAL);
+
+static const struct data_store_field_t rollup_data_fields_[] = {
+    DATA_STORE_FIELD(RECORD, timestamp, DATA_STORE_FIELD_TIME, 32),
+    DATA_STORE_FIELD(RECORD, seq, DATA_STORE_FIELD_SEQUENCE, 16),
+    DATA_STORE_FIELD(RECORD, boot_id, DATA_STORE_FIELD_UNSIGNED, 16),
+    DATA_STORE_FIELD(RECORD, clock_unsynced, DATA_STORE_FIELD_BOOL, 1),
+    DATA_STORE_FIELD(RECORD, rollup.period, DATA_STORE_FIELD_UNSIGNED, 2),
+    DATA_STORE_PUBLISHED_FIELD(RECORD, rollup.seconds,
+                               DATA_STORE_FIELD_UNSIGNED, 32, "seconds",
+                               DATA_STORE_JSON_NUMBER),
+    DATA_STORE_PUBLISHED_FIELD(RECORD, rollup.pump_on_s,
+                               DATA_STORE_FIELD_UNSIGNED, 32, "pump_on_s",
+                               DATA_STORE_JSON_NUMBER),
+    DATA_STORE_PUBLISHED_FIELD(RECORD, rollup.pump_cycles,
+                               DATA_STORE_FIELD_UNSIGNED, 16, "pump_cycles",
+                               DATA_STORE_JSON_NUMBER),
+    DATA_STORE_PUBLISHED_FIELD(RECORD, rollup.light_dose,
+                               DATA_STORE_FIELD_UNSIGNED, 32, "light_dose",
+                               DATA_STORE_JSON_NUMBER),
+    DATA_STORE_PUBLISHED_FIELD(RECORD, rollup.min_free_heap_size,
+                               DATA_STORE_FIELD_UNSIGNED, 32,
+                               "min_free_heap_size", DATA_STORE_JSON_NONZERO),
+    DATA_STORE_PUBLISHED_FIELD(RECORD, rollup.max_free_heap_size,
+                               DATA_STORE_FIELD_UNSIGNED, 32,
+                               "max_free_heap_size", DATA_STORE_JSON_NONZERO),
+};
+
+DATA_STORE_DEFINE(rollup_data_store_, "rollup", DATA_STORE_STREAM_ROLLUP,
+                  RECORD, rollup_data_fields_, "/store/log_data/rollup",
+                  ROLLUP_DATA_BUFFER_SIZE, ROLLUP_DATA_QUOTA);
+
+static const struct data_store_field_t pump_cycle_data_fields_[] = {
+    DATA_STORE_FIELD(RECORD, timestamp, DATA_STORE_FIELD_TIME, 32),
+    DATA_STORE_FIELD(RECORD, seq, DATA_STORE_FIELD_SEQUENCE, 16),
+    DATA_STORE_FIELD(RECORD, boot_id, DATA_STORE_FIELD_UNSIGNED, 16),
+    DATA_STORE_FIELD(RECORD, clock_unsynced, DATA_STORE_FIELD_BOOL, 1),
+    DATA_STORE_PUBLISHED_FIELD(RECORD, pump_cycle.planned_s,
+                               DATA_STORE_FIELD_UNSIGNED, 32, "planned_s",
+                               DATA_STORE_JSON_NUMBER),
+    DATA_STORE_PUBLISHED_FIELD(RECORD, pump_cycle.actual_s,
+                               DATA_STORE_FIELD_UNSIGNED, 32, "actual_s",
+                               DATA_STORE_JSON_NUMBER),
+    DATA_STORE_FIELD(RECORD, pump_cycle.end_reason, DATA_STORE_FIELD_UNSIGNED,
+                     2),
+};
+
+DATA_STORE_DEFINE(pump_cycle_data_store_, "pump_cycle",
+                  DATA_STORE_STREAM_PUMP_CYCLE, RECORD, pump_cycle_data_fields_,
+                  "/store/log_data/cycle", PUMP_CYCLE_DATA_BUFFER_SIZE,
+                  PUMP_CYCLE_DATA_QUOTA);
+
+/**
+ * @brief Add the status of a pump record.
+ *
+ * @param record pump record
+ * @param data JSON object to add to
+ * @param is_published unused
+ */
+static void pump_add_json(const struct data_logging_record_t *record,
+                          cJSON *data, bool is_published) {
+  cJSON_AddStringToObject(data, "status", record->pump_on ? "start" : "stop");
+}
+
+/**
+ * @brief Set the usage of the storage at the time a memory record is logged.
+ *
+ * @param record memory record
+ */
+static void memory_complete(struct data_logging_record_t *record) {
+  size_t total_bytes;
+  size_t used_bytes = 0;
+  data_store_storage_info(&total_bytes, &used_bytes);
+  record->memory.store_used_bytes = used_bytes;
+}
+
+/**
+ * @brief Add the size of the storage and, if published, its current usage.
+ *
+ * @param record memory record
+ * @param data JSON object to add to
+ * @param is_published true if the record is published to its topic
+ */
+static void memory_add_json(const struct data_logging_record_t *record,
+                            cJSON *data, bool is_published) {
+  size_t store_total_bytes = 0;
+  size_t store_used_bytes;
+  data_store_storage_info(&store_total_bytes, &store_used_bytes);
+  cJSON_AddNumberToObject(data, "store_total_bytes", store_total_bytes);
+  if (is_published) {
+    // The usage is current, so it is not part of the stored record.
+    data_store_add_usage_json(cJSON_AddObjectToObject(data, "store_usage"));
+  }
+}
+
+/**
+ * @brief Add the period of a rollup record.
+ *
+ * @param record rollup record
+ * @param data JSON object to add to
+ * @param is_published unused
+ */
+static void rollup_add_json(const struct data_logging_record_t *record,
+                            cJSON *data, bool is_published) {
+  cJSON_AddStringToObject(data, "period",
+                          data_rollup_period_name(record->rollup.period));
+}
+
+/**
+ * @brief Add the end reason of a pump cycle record.
+ *
+ * @param record pump cycle record
+ * @param data JSON object to add to
+ * @param is_published unused
+ */
+static void pump_cycle_add_json(const struct data_logging_record_t *record,
+                                cJSON *data, bool is_published) {
+  static const char *const names[] = {
+      [DATA_LOGGING_PUMP_END_COMPLETED] = "completed",
+      [DATA_LOGGING_PUMP_END_RECONFIGURED] = "reconfigured",
+      [DATA_LOGGING_PUMP_END_REBOOT] = "reboot",
+  };
+  const uint8_t end_reason = record->pump_cycle.end_reason;
+  cJSON_AddStringToObject(data, "end",
+                          end_reason < sizeof(names) / sizeof(names[0])
+                              ? names[end_reason]
+                              : "unknown");
+}
+
+const struct data_stream_t data_streams[DATA_LOGGING_NR_RECORD_TYPES] = {
+    [DATA_LOGGING_RECORD_PUMP] =
+        {
+            .store = &pump_data_store_,
+            .topic = CONFIG_MQTT_PUMP_STATUS_TOPIC,
+            .qos = 1,
+            .is_rollup_only = IS_PUMP_ROLLUP_ONLY,
+            .add_json = pump_add_json,
+        },
+    [DATA_LOGGING_RECORD_LIGHT] =
+        {
+            .store = &light_data_store_,
+            .topic = CONFIG_MQTT_LIGHT_STATUS_TOPIC,
+            .qos = 1,
+            .compression = &light_compression_,
+        },
+    [DATA_LOGGING_RECORD_MEMORY] =
+        {
+            .store = &memory_data_store_,
+            .topic = "ef/efc/timed/heap",
+            .qos = 1,
+            .compression = &memory_compression_,
+            .complete = memory_complete,
+            .add_json = memory_add_json,
+        },
+    [DATA_LOGGING_RECORD_ROLLUP] =
+        {
+            .store = &rollup_data_store_,
+            .topic = CONFIG_MQTT_ROLLUP_STATUS_TOPIC,
+            .qos = 1,
+            .add_json = rollup_add_json,
+        },
+    [DATA_LOGGING_RECORD_PUMP_CYCLE] =
+        {
+            .store = &pump_cycle_data_store_,
+            .topic = CONFIG_MQTT_PUMP_CYCLE_TOPIC,
+            .qos = 1,
+            .add_json = pump_cycle_add_json,
+        },
+};
+
+void data_stream_init_all() {
+  for (unsigned int i = 0; i < DATA_LOGGING_NR_RECORD_TYPES; i++) {
+    data_store_init(data_streams[i].store);
+  }
+}
+
+const struct data_stream_t *
+data_stream_of(const struct data_logging_record_t *record) {
+  if ((unsigned int)record->type >= DATA_LOGGING_NR_RECORD_TYPES) {
+    return NULL;
+  }
+  return &data_streams[record->type];
+}
+
+const struct data_stream_t *data_stream_find(const char *name) {
+  for (unsigned int i = 0; i < DATA_LOGGING_NR_RECORD_TYPES; i++) {
+    if (strcmp(name, data_streams[i].store->name) == 0) {
+      return &data_streams[i];
+    }
+  }
+  return NULL;
+}
+
+bool data_stream_read(const struct data_stream_t *stream,
+                      struct data_logging_record_t *record) {
+  if (!data_store_read(stream->store, record)) {
+    return false;
+  }
+  // The type is not stored, it is given by the stream.
+  record->type = stream - data_streams;
+  return true;
+}
+
+/**
+ * @brief Create the JSON object of a record.
+ *
+ * @param stream stream of the record
+ * @param record record to convert
+ * @param is_published true if the record is published to its topic
+ * @return cJSON* JSON object which needs to be deleted by the caller
+ */
+static cJSON *record_to_json(const struct data_stream_t *stream,
+                             const struct data_logging_record_t *record,
+                             bool is_published) {
+  cJSON *data = data_store_create_json(record->timestamp, record->seq,
+                                       record->boot_id, record->clock_unsynced);
+  data_store_add_fields_json(stream->store, record, data);
+  if (stream->add_json != NULL) {
+    stream->add_json(record, data, is_published);
+  }
+  return data;
+}
+
+int data_stream_publish(const struct data_stream_t *stream,
+                        const struct data_logging_record_t *record) {
+  cJSON *data = record_to_json(stream, record, true);
+  char *data_json_string = cJSON_PrintUnformatted(data);
+  cJSON_Delete(data);
+  const int msg_id =
+      mqtt5_sent_message_qos(stream->topic, data_json_string, stream->qos);
+  cJSON_free(data_json_string);
+  return msg_id;
+}
+
+/**
+ * @brief Context of a query passed to each queried record.
+ *
+ */
+struct query_context_t {
+  const struct data_stream_t *stream; // queried stream
+  cJSON *records;                     // JSON array to add to
+};
+
+/**
+ * @brief Add a queried record to a JSON array.
+ *
+ * @param item queried record
+ * @param context struct query_context_t of the query
+ */
+static void query_cb_(const void *item, void *context) {
+  const struct query_context_t *query = context;
+  cJSON_AddItemToArray(query->records,
+                       record_to_json(query->stream, item, false));
+}
+
+bool data_stream_query(const struct data_stream_t *stream, time_t from,
+                       time_t to, const uint32_t *after_seq,
+                       unsigned int max_records, cJSON *records,
+                       uint32_t *last_seq) {
+  struct query_context_t context = {.stream = stream, .records = records};
+  return data_store_query(stream->store, from, to, after_seq, max_records,
+                          query_cb_, &context, last_seq);
+}
@@ -0,0 +1,106 @@
+#ifndef COMPONENTS_MQTT5_CONNECTION_DATA_STREAM
+#define COMPONENTS_MQTT5_CONNECTION_DATA_STREAM
+/**
+ * @brief Registry of the logged data streams.
+ *
+ * Each record type has one entry describing its stream: the data store with
+ * the layout and the published names of the record fields, the topic, the QoS
+ * and the compression. Storing, publishing and querying the records is driven
+ * by the entry. The stores hold the records of the data logging task as they
+ * are, so a new stream needs a record type, an array of fields and an entry,
+ * but no code of its own.
+ *
+ * Only used by the data logging task.
+ *
+ */
+
+#include "cJSON.h"
+#include "data_compression.h"
+#include "data_logging_ring.h"
+#include "data_store.h"
+
+/**
+ * @brief Description of one stream.
+ *
+ */
+struct data_stream_t {
+  struct data_store_t *store; // store of the records, named after the stream
+  const char *topic;          // topic the records are published to
+  int qos;                    // QoS of the published records, 0 or 1
+  bool is_rollup_only;        // records only feed the rollups, none is logged
+  // compression of the records before they are logged, NULL if none
+  struct data_compression_t *compression;
+  // completes a record before it is logged, NULL if not needed
+  void (*complete)(struct data_logging_record_t *record);
+  // adds values to the JSON which are not record fields, NULL if none.
+  // is_published is false if the record is part of a query response.
+  void (*add_json)(const struct data_logging_record_t *record, cJSON *data,
+                   bool is_published);
+};
+
+/** @brief Streams of all record types, indexed by data_logging_record_type. */
+extern const struct data_stream_t data_streams[DATA_LOGGING_NR_RECORD_TYPES];
+
+/**
+ * @brief Initialize the stores of all streams.
+ *
+ */
+void data_stream_init_all();
+
+/**
+ * @brief Get the stream of a record.
+ *
+ * @param record record of the stream
+ * @return const struct data_stream_t* stream, NULL for an unknown record type
+ */
+const struct data_stream_t *
+data_stream_of(const struct data_logging_record_t *record);
+
+/**
+ * @brief Find a stream by its name.
+ *
+ * @param name name of the stream
+ * @return const struct data_stream_t* stream, NULL if there is none
+ */
+const struct data_stream_t *data_stream_find(const char *name);
+
+/**
+ * @brief Read the next record of a stream without removing it from its store.
+ *
+ * @param stream stream to read from
+ * @param record output for the record
+ * @return true if a record was read, see data_store_read
+ */
+bool data_stream_read(const struct data_stream_t *stream,
+                      struct data_logging_record_t *record);
+
+/**
+ * @brief Publish a record to the topic of its stream.
+ *
+ * @param stream stream of the record
+ * @param record record to publish
+ * @return int message id of the sent message. Negative if failed.
+ */
+int data_stream_publish(const struct data_stream_t *stream,
+                        const struct data_logging_record_t *record);
+
+/**
+ * @brief Add the stored records of a stream within a time window to a JSON
+ * array.
+ *
+ * @param stream stream to query
+ * @param from start of the time window, inclusive
+ * @param to end of the time window, inclusive
+ * @param after_seq skip the records up to this sequence number, NULL for none
+ * @param max_records maximum number of records to add
+ * @param records JSON array to add the records to
+ * @param last_seq output for the sequence number to continue after if
+ * incomplete
+ * @return true if all records of the time window were added
+ */
+bool data_stream_query(const struct data_stream_t *stream, time_t from,
+                       time_t to, const uint32_t *after_seq,
+                       unsigned int max_records, cJSON *records,
+                       uint32_t *last_seq);
+
+#endif /* COMPONENTS_MQTT5_CONNECTION_DATA_STREAM */
@@ -0,0 +1,81 @@
+#ifndef COMPONENTS_MQTT5_CONNECTION_INCLUDE_DATA_CLOCK
+#define COMPONENTS_MQTT5_CONNECTION_INCLUDE_DATA_CLOCK
+/**
+ * @brief Quality of the timestamps of the logged records.
+ *
+ * Until SNTP synchronized the time, the clock counts the uptime from a fixed
+ * date. Records logged meanwhile are marked as unsynced together with the id of
+ * the boot. Once the time is synchronized, the offset between both clocks is
+ * saved for the boot, so all unsynced records of the boot are rebased by this
+ * offset when they are published. The offsets of the last
+ * DATA_CLOCK_NR_BOOTS boots are kept in NVS.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/** @brief Number of boots whose offsets are kept. */
+#define DATA_CLOCK_NR_BOOTS 8
+
+/**
+ * @brief Quality of the timestamp of a record.
+ *
+ */
+enum data_clock_quality {
+  DATA_CLOCK_SYNCED,   // logged with the synchronized time
+  DATA_CLOCK_REBASED,  // logged before the synchronization, rebased since
+  DATA_CLOCK_UNSYNCED, // logged before the synchronization, offset unknown
+};
+
+/**
+ * @brief Initialize the boot id and load the offsets of the previous boots.
+ *
+ * Needs to be called after the clock was set to its start date.
+ */
+void data_clock_init();
+
+/**
+ * @brief Get the id of the current boot.
+ *
+ * @return uint16_t id increasing with every boot
+ */
+uint16_t data_clock_boot_id();
+
+/**
+ * @brief Check if records are logged with the synchronized time.
+ *
+ * @return true if the time was synchronized
+ */
+bool data_clock_is_synced();
+
+/**
+ * @brief Save the offset of the current boot after the synchronization.
+ *
+ * Only called from the data logging task.
+ */
+void data_clock_synced();
+
+/**
+ * @brief Rebase the timestamp of a record.
+ *
+ * Only called from the data logging task.
+ *
+ * @param boot_id boot the record was logged in
+ * @param is_unsynced true if the record was logged before the synchronization
+ * @param timestamp timestamp of the record, rebased if the offset is known
+ * @return enum data_clock_quality quality of the timestamp
+ */
+enum data_clock_quality data_clock_rebase(uint16_t boot_id, bool is_unsynced,
+                                          time_t *timestamp);
+
+/**
+ * @brief Get the name of a timestamp quality used in the published records.
+ *
+ * @param quality quality of a timestamp
+ * @return const char* name of the quality
+ */
+const char *data_clock_quality_name(enum data_clock_quality quality);
+
+#endif /* COMPONENTS_MQTT5_CONNECTION_INCLUDE_DATA_CLOCK */
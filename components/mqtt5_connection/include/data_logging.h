@@ -23,6 +23,8 @@ enum data_logging_event_type {
   DATA_LOGGING_EVENT_CONNECTED = 1,
   DATA_LOGGING_EVENT_DISCONNECTED = 2,
   DATA_LOGGING_EVENT_DATA_PUBLISHED = 3,
+  DATA_LOGGING_EVENT_DATA_QUERY = 4,
+  DATA_LOGGING_EVENT_CLOCK_SYNCED = 5,
 };
 
 /**
@@ -34,20 +36,63 @@ struct data_logging_event_t {
 };
 
 /**
- * @brief Log the free heap size for debugging.
+ * @brief Reason why a pump cycle ended.
  *
  */
-void log_heap_size();
+enum data_logging_pump_end {
+  DATA_LOGGING_PUMP_END_COMPLETED = 0,    // the planned duration passed
+  DATA_LOGGING_PUMP_END_RECONFIGURED = 1, // the pump time changed meanwhile
+  DATA_LOGGING_PUMP_END_REBOOT = 2,       // the device restarted meanwhile
+};
 
 /**
- * @brief Add new data to the data logging queue.
+ * @brief Add new pump data to the data logging.
+ *
+ * Only called from the pump control task. Never blocks, the record is dropped
+ * if the data logging task falls behind. The raw events feed the rollups and
+ * are only logged if CONFIG_MQTT_DATA_LOGGING_PUMP_RAW_EVENTS is set.
  *
- * @param topic Topic to which the data is going to be added.
- * @param data Data to be added in cJSON format.
+ * @param pump_on true if the pump was switched on.
  */
 void add_pump_data_item(bool pump_on);
 /**
- * @brief Add new light data to the data logging queue.
+ * @brief Save the start of a pump cycle in NVS.
+ *
+ * Only called from the pump control task when the pump is started. If the
+ * device restarts before the cycle ends, the cycle is logged at the next boot
+ * with the end reason DATA_LOGGING_PUMP_END_REBOOT.
+ *
+ * @param planned_s planned duration of the cycle in seconds
+ */
+void save_pump_cycle_start(uint32_t planned_s);
+/**
+ * @brief Save how long the running pump cycle lasts so far in NVS.
+ *
+ * Only called from the pump control task. The saved duration is logged as
+ * actual duration if the device restarts before the cycle ends.
+ *
+ * @param actual_s seconds the pump is running so far
+ */
+void save_pump_cycle_progress(uint32_t actual_s);
+/**
+ * @brief Add a finished pump cycle to the data logging.
+ *
+ * Only called from the pump control task when the pump is stopped. Never
+ * blocks, the record is dropped if the data logging task falls behind. The
+ * record is timestamped with the start of the cycle. The saved start of the
+ * cycle is removed.
+ *
+ * @param planned_s planned duration of the cycle in seconds
+ * @param actual_s measured duration of the cycle in seconds
+ * @param end_reason reason why the cycle ended
+ */
+void add_pump_cycle_item(uint32_t planned_s, uint32_t actual_s,
+                         enum data_logging_pump_end end_reason);
+/**
+ * @brief Add new light data to the data logging.
+ *
+ * Only called from the light control task. Never blocks, the record is dropped
+ * if the data logging task falls behind.
  *
  * @param intensity Intensity value to be logged.
  */
@@ -71,6 +116,18 @@ void set_disconnected();
  */
 void set_data_published(unsigned int id);
 
+/**
+ * @brief Set the data query received event.
+ *
+ */
+void set_data_query_received();
+
+/**
+ * @brief Set the clock synchronized event.
+ *
+ */
+void set_clock_synced();
+
 /**
  * @brief Initialize the data logging system.
  *
@@ -0,0 +1,40 @@
+#ifndef COMPONENTS_MQTT5_CONNECTION_INCLUDE_DATA_QUERY
+#define COMPONENTS_MQTT5_CONNECTION_INCLUDE_DATA_QUERY
+/**
+ * @brief Request/response endpoint for the stored data of a time window.
+ *
+ * A request names a stream and a time window. The response holds the stored
+ * records of this window, at most CONFIG_MQTT_DATA_QUERY_MAX_RECORDS. If more
+ * records are available, the request is repeated with the sequence number of
+ * the last returned record as after_seq.
+ * Only one request is answered at a time.
+ *
+ */
+
+#include "mqtt_shared.h"
+
+/**
+ * @brief Subscribe to the data query channel.
+ *
+ * @param client mqtt client
+ */
+void subscribe_to_data_query_channel(esp_mqtt_client_handle_t client);
+
+/**
+ * @brief Callback function if a new data query arrived.
+ *
+ * The query is answered by the data logging task.
+ *
+ * @param event event including the arrived query
+ */
+void new_data_query_received_cb(esp_mqtt_event_handle_t event);
+
+/**
+ * @brief Answer the received data query.
+ *
+ * Only called from the data logging task.
+ *
+ */
+void answer_data_query();
+
+#endif /* COMPONENTS_MQTT5_CONNECTION_INCLUDE_DATA_QUERY */
@@ -0,0 +1,50 @@
+#ifndef COMPONENTS_MQTT5_CONNECTION_INCLUDE_DATA_SHIPPING
+#define COMPONENTS_MQTT5_CONNECTION_INCLUDE_DATA_SHIPPING
+/**
+ * @brief Bulk shipping of the segments on the storage.
+ *
+ * Instead of replaying the stored records one by one, the segments are
+ * published with their raw encoding as binary messages. A segment is split
+ * into chunks fitting CONFIG_MQTT_DATA_BULK_MAX_PACKET_SIZE and up to
+ * CONFIG_MQTT_DATA_BULK_WINDOW chunks wait for their acknowledgement at once.
+ * A segment is removed from the storage after all its chunks are acknowledged.
+ * Use tools/data_decoder to decode the messages.
+ *
+ * All functions are only called from the data logging task.
+ *
+ */
+
+#include <stdbool.h>
+
+/**
+ * @brief Publish chunks until the window of unacknowledged chunks is full.
+ *
+ * @return true if chunks wait for their acknowledgement
+ */
+bool data_shipping_schedule();
+
+/**
+ * @brief Handle the acknowledgement of a published message.
+ *
+ * @param id message id of the published message
+ * @return true if the message was a shipped chunk
+ */
+bool data_shipping_published(int id);
+
+/**
+ * @brief Check if chunks wait for their acknowledgement.
+ *
+ * @return true if chunks are in flight
+ */
+bool data_shipping_is_in_flight();
+
+/**
+ * @brief Forget all unacknowledged chunks.
+ *
+ * The current segment is shipped again from its start.
+ *
+ * @return true if chunks waited for their acknowledgement
+ */
+bool data_shipping_restore();
+
+#endif /* COMPONENTS_MQTT5_CONNECTION_INCLUDE_DATA_SHIPPING */
@@ -0,0 +1,662 @@
+#ifndef COMPONENTS_MQTT5_CONNECTION_INCLUDE_DATA_STORE
+#define COMPONENTS_MQTT5_CONNECTION_INCLUDE_DATA_STORE
+/**
+ * @brief Generic store for telemetry streams.
+ *
+ * A data store keeps its records in three tiers. Records are pushed to RAM
+ * buffers, the newest of them are mirrored to RTC memory and older records are
+ * written as segments to the flash storage.
+ *
+ * If a RAM buffer is full, new records are pushed to a second buffer. The full
+ * buffer is only written to the storage by a writer task if it is not drained
+ * within CONFIG_MQTT_DATA_LOGGING_SPILL_DELAY seconds or if the second buffer
+ * is half full. So records of a short outage are sent from RAM without ever
+ * touching the flash.
+ * Records are always returned oldest first: segments on the storage are
+ * replayed in the order they were written before the records in the RAM
+ * buffers. All streams share this implementation and only differ in the record
+ * type, the location on the storage and the size of the RAM buffers.
+ *
+ * Segments are compressed on the way to the storage. Each field of a record is
+ * stored as the varint encoded difference to the previous record and unchanged
+ * fields are skipped. The fields of a record type are described by an array of
+ * struct data_store_field_t.
+ *
+ * In the RAM buffers the records are bit packed. Timestamps are stored as 32
+ * bit offset to the oldest record in the buffer and all other fields with the
+ * number of bits given in their description.
+ *
+ * The newest records which are not yet on the storage are mirrored to a small
+ * tail buffer in RTC memory. It survives a soft reset and the records are
+ * pushed again on the next boot. On a restart, stores whose records are all
+ * mirrored are not written to the storage.
+ *
+ * Every segment starts with a header holding the time range of its records.
+ * The ranges are kept in an index in RAM, so historical records can be queried
+ * without reading the segments outside of the requested time window.
+ *
+ * If bulk shipping is enabled, the segments of the streams are not replayed.
+ * Instead they are read in chunks with their raw encoding and removed after
+ * they were shipped.
+ *
+ * Each stream has a quota of bytes on the storage. If writing a segment would
+ * exceed the quota or fill the storage, the oldest segments of the stream are
+ * evicted first.
+ *
+ * The storage backend is selected in the configuration. Either segments are
+ * files on the storage partition mounted with SPIFFS or LittleFS, tracked by a
+ * small manifest file per stream, or they are appended as crc protected
+ * records to a log on the raw storage partition.
+ *
+ */
+
+#include "cJSON.h"
+#include "esp_attr.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @brief Ids of the streams.
+ *
+ * The id is persisted together with the segments. Never change the values of
+ * existing streams.
+ */
+enum data_store_stream_id {
+  DATA_STORE_STREAM_PUMP = 0,
+  DATA_STORE_STREAM_LIGHT = 1,
+  DATA_STORE_STREAM_MEMORY = 2,
+  DATA_STORE_STREAM_ROLLUP = 3,
+  DATA_STORE_STREAM_PUMP_CYCLE = 4,
+  DATA_STORE_NR_STREAMS,
+};
+
+/**
+ * @brief Size of the buffers for replaying a segment in bytes.
+ *
+ * Segments are read in chunks of this size. Needs to hold at least one record.
+ */
+#define DATA_STORE_REPLAY_WINDOW_SIZE (2 * CONFIG_SPIFFS_PAGE_SIZE)
+
+/**
+ * @brief Size of the buffer for encoding a segment in bytes.
+ *
+ * Encoded records are collected in this buffer before they are written to the
+ * storage.
+ */
+#define DATA_STORE_ENCODE_BUFFER_SIZE CONFIG_SPIFFS_PAGE_SIZE
+
+/** @brief Size of the tail buffer in RTC memory of each store in bytes. */
+#define DATA_STORE_RTC_TAIL_SIZE CONFIG_MQTT_DATA_LOGGING_RTC_TAIL_SIZE
+
+/**
+ * @brief Number of sequence numbers reserved in NVS at once.
+ *
+ * After a reboot, the sequence numbers continue behind the reserved ones.
+ */
+#define DATA_STORE_SEQUENCE_BLOCK 256
+
+/** @brief Number of records per store which are read but not committed. */
+#define DATA_STORE_MAX_IN_FLIGHT CONFIG_MQTT_DATA_LOGGING_MAX_IN_FLIGHT
+
+/** @brief Maximum number of fields of a record. */
+#define DATA_STORE_MAX_FIELDS 11
+
+/** @brief Maximum size of a record in bytes. */
+#define DATA_STORE_MAX_ITEM_SIZE 48
+
+/**
+ * @brief Number of segments per store in the index.
+ *
+ * Older segments are still replayed, but a query needs to read their headers.
+ */
+#define DATA_STORE_INDEX_SIZE 32
+
+/**
+ * @brief Encoding of a record field in the stored segments.
+ */
+enum data_store_field_type {
+  DATA_STORE_FIELD_UNSIGNED, // unsigned integer, delta encoded
+  DATA_STORE_FIELD_SIGNED,   // signed integer, delta encoded
+  DATA_STORE_FIELD_BOOL,     // bool, only changes are encoded
+  DATA_STORE_FIELD_TIME,     // time_t, relative to the buffer start in RAM
+  DATA_STORE_FIELD_SEQUENCE, // uint32_t, relative to the buffer start in RAM
+};
+
+/**
+ * @brief Representation of a record field in the published JSON.
+ */
+enum data_store_json_type {
+  DATA_STORE_JSON_NONE,    // not published
+  DATA_STORE_JSON_NUMBER,  // published as number
+  DATA_STORE_JSON_NONZERO, // published as number, omitted if 0
+  DATA_STORE_JSON_BOOL,    // published as bool
+};
+
+/**
+ * @brief Description of one field of a record.
+ *
+ * Use DATA_STORE_FIELD or DATA_STORE_PUBLISHED_FIELD to create the
+ * description of a struct member.
+ */
+struct data_store_field_t {
+  uint8_t offset;   // offset of the field in the record
+  uint8_t size;     // size of the field in bytes (1, 2, 4 or 8)
+  uint8_t type;     // encoding of the field, see data_store_field_type
+  uint8_t bits;     // number of bits in the packed RAM buffer
+  uint8_t json;     // representation in JSON, see data_store_json_type
+  const char *name; // key in the published JSON, NULL if not published
+};
+
+/**
+ * @brief Describe a member of a record type.
+ *
+ * @param item_type type of the record
+ * @param member name of the member
+ * @param field_type encoding of the member, see data_store_field_type
+ * @param nr_bits number of bits in the packed RAM buffer. Larger unsigned
+ * values are saturated. DATA_STORE_FIELD_TIME fields always use 32 bits.
+ * DATA_STORE_FIELD_SEQUENCE fields start a new buffer if the sequence number
+ * differs too much from the first one of the buffer.
+ */
+#define DATA_STORE_FIELD(item_type, member, field_type, nr_bits)               \
+  {                                                                            \
+      .offset = offsetof(item_type, member),                                   \
+      .size = sizeof(((item_type *)0)->member),                                \
+      .type = field_type,                                                      \
+      .bits = nr_bits,                                                         \
+  }
+
+/**
+ * @brief Describe a member of a record type which is published.
+ *
+ * @param item_type type of the record
+ * @param member name of the member
+ * @param field_type encoding of the member, see data_store_field_type
+ * @param nr_bits number of bits in the packed RAM buffer, see DATA_STORE_FIELD
+ * @param key key of the member in the published JSON
+ * @param json_type representation in the JSON, see data_store_json_type
+ */
+#define DATA_STORE_PUBLISHED_FIELD(item_type, member, field_type, nr_bits,     \
+                                   key, json_type)                             \
+  {                                                                            \
+      .offset = offsetof(item_type, member),                                   \
+      .size = sizeof(((item_type *)0)->member),                                \
+      .type = field_type,                                                      \
+      .bits = nr_bits,                                                         \
+      .json = json_type,                                                       \
+      .name = key,                                                             \
+  }
+
+/**
+ * @brief One of the two RAM buffers of a data store.
+ */
+struct data_store_buffer_t {
+  uint8_t *items;     // ring buffer holding packed records
+  unsigned int head;  // index of the next record to write
+  unsigned int tail;  // index of the oldest record
+  unsigned int count; // number of records in the buffer
+  int64_t time_base;  // time the packed timestamps are relative to
+  uint32_t seq_base;  // sequence number the packed ones are relative to
+  int64_t max_time;   // timestamp of the newest record
+};
+
+/**
+ * @brief Time range of one segment on the storage.
+ */
+struct data_store_index_entry_t {
+  int64_t min_time;  // timestamp of the oldest record
+  int64_t max_time;  // timestamp of the newest record
+  uint32_t location; // location of the segment in the storage backend
+};
+
+/** @brief Version of the chunk format of shipped segments. */
+#define DATA_STORE_CHUNK_VERSION 2
+/** @brief Flag of the chunk ending its segment. */
+#define DATA_STORE_CHUNK_LAST 0x01
+
+/**
+ * @brief Header in front of each shipped chunk of a segment.
+ *
+ * All values are little endian. The field types allow decoding the segment
+ * without knowing the record type of the stream.
+ */
+struct data_store_chunk_header_t {
+  uint8_t version;   // DATA_STORE_CHUNK_VERSION
+  uint8_t board_id;  // id of the board
+  uint8_t stream_id; // id of the stream, see data_store_stream_id
+  uint8_t flags;     // DATA_STORE_CHUNK_LAST if the chunk ends the segment
+  uint32_t location; // location of the segment in the storage backend
+  uint32_t offset;   // offset of the chunk in the segment
+  uint8_t nr_fields; // number of fields of a record
+  // type of each field, see data_store_field_type
+  uint8_t field_types[DATA_STORE_MAX_FIELDS];
+};
+
+_Static_assert(sizeof(struct data_store_chunk_header_t) == 24,
+               "The chunk header is part of the shipping format");
+
+/**
+ * @brief Position of a shipped chunk.
+ */
+struct data_store_chunk_t {
+  uint8_t stream_id; // id of the stream of the segment
+  uint32_t location; // location of the segment in the storage backend
+  size_t offset;     // offset of the chunk in the segment
+  size_t size;       // number of segment bytes in the chunk
+  bool is_last;      // the chunk ends the segment
+};
+
+/**
+ * @brief Newest records of a data store which are not yet on the storage.
+ *
+ * Lives in RTC memory which is not initialized on boot, so the crc is checked
+ * before the records are used.
+ */
+struct data_store_rtc_tail_t {
+  uint32_t crc;       // crc of all following fields
+  uint8_t stream_id;  // id of the stream owning the records
+  uint8_t nr_fields;  // number of fields of a record
+  uint16_t item_size; // size of one record in bytes
+  uint16_t head;      // index of the next record to write
+  uint16_t count;     // number of records before head
+  // ring buffer of records
+  uint8_t items[DATA_STORE_RTC_TAIL_SIZE];
+};
+
+/**
+ * @brief Backlog of a data store, see data_store_get_stats.
+ */
+struct data_store_stats_t {
+  unsigned int nr_records;  // records in RAM which are not acknowledged
+  unsigned int nr_segments; // segments on the storage
+  size_t used_bytes;        // bytes of the segments on the storage
+  bool has_oldest;          // false if the store is empty
+  int64_t oldest_time;      // timestamp of the oldest record in the store
+  unsigned int nr_dropped;  // records dropped since boot, both buffers full
+  unsigned int nr_evicted;  // segments evicted to make space since boot
+};
+
+/**
+ * @brief State of one data store.
+ *
+ * Use DATA_STORE_DEFINE to create a store together with its buffers.
+ */
+struct data_store_t {
+  const char *name;     // name of the stream used for logging
+  uint8_t stream_id;    // id of the stream, see data_store_stream_id
+  const char *dir_path; // directory holding the segment files
+  size_t item_size;     // size of one record in bytes
+  // fields of a record
+  const struct data_store_field_t *fields;
+  unsigned int nr_fields; // number of fields
+  size_t buffer_size;     // size of both RAM buffers in bytes
+  size_t quota;           // maximum bytes of the segments on the storage
+  size_t packed_size;     // size of one packed record in bytes
+  unsigned int capacity;  // maximum number of records in one RAM buffer
+  // RAM buffers, records are pushed to buffers[active]
+  struct data_store_buffer_t buffers[2];
+  unsigned int active;       // index of the buffer records are pushed to
+  bool is_pending;           // the other buffer waits for the writer task
+  TickType_t pending_since;  // tick count when the other buffer got pending
+  unsigned int nr_dropped;   // records dropped since boot, both buffers full
+  uint32_t next_record_seq;  // sequence number of the next record
+  uint32_t record_seq_limit; // first sequence number not reserved in NVS
+  bool is_shipped;           // segments are shipped instead of replayed
+  // newest records in the RAM buffers, kept over a soft reset
+  struct data_store_rtc_tail_t *rtc_tail;
+  unsigned int rtc_capacity; // maximum number of records in rtc_tail
+  SemaphoreHandle_t mutex; // protects all fields above
+  StaticSemaphore_t mutex_buffer;
+  size_t replay_offset;      // bytes of the oldest segment already read
+  uint8_t *replay_items;     // decoded records of the replayed segment
+  unsigned int replay_count; // number of records in replay_items
+  unsigned int replay_pos;   // index of the next record in replay_items
+  // last decoded field values of the replayed segment
+  uint64_t replay_prev[DATA_STORE_MAX_FIELDS];
+  // records read but not committed, oldest first
+  uint8_t *in_flight_items;
+  unsigned int in_flight_tail;  // position of the oldest record
+  unsigned int in_flight_count; // number of records not committed
+  unsigned int in_flight_pos;   // number of records read since the rollback
+  // per position of in_flight_items, set if the record is still in the oldest
+  // segment on the storage
+  bool in_flight_is_stored[DATA_STORE_MAX_IN_FLIGHT];
+  size_t used_bytes;       // bytes of the segments on the storage
+  unsigned int nr_evicted; // segments evicted to make space since boot
+  // time ranges of the newest segments, oldest first
+  struct data_store_index_entry_t index[DATA_STORE_INDEX_SIZE];
+  unsigned int index_tail;  // position of the oldest entry in index
+  unsigned int index_count; // number of entries in index
+  // encoded records not yet written to the storage
+  uint8_t encode_buffer[DATA_STORE_ENCODE_BUFFER_SIZE];
+#if CONFIG_MQTT_DATA_LOGGING_BACKEND_FLASH_LOG
+  size_t region_offset;     // offset of the region in the partition
+  size_t region_size;       // size of the region in bytes
+  size_t tail_offset;       // offset of the oldest segment in the region
+  size_t head_offset;       // offset of the next segment in the region
+  size_t erased_end;        // end of the erased flash behind head_offset
+  uint32_t next_seq;        // sequence number of the next segment
+  unsigned int nr_segments; // number of unread segments in the region
+  size_t write_size;        // payload bytes of the segment being written
+  uint32_t write_crc;       // crc of the payload of the segment being written
+#else
+  unsigned int tail_file_id; // file id of the oldest segment
+  unsigned int head_file_id; // file id of the next segment to write
+  int segment_fd;            // file of the segment being written
+  // chunk of the replayed segment file
+  uint8_t replay_window[DATA_STORE_REPLAY_WINDOW_SIZE];
+  // static path avoiding allocating mem on the stack
+  char path[CONFIG_SPIFFS_OBJ_NAME_LEN];
+#endif
+  // protects the replay and storage fields, taken before mutex
+  SemaphoreHandle_t storage_mutex;
+  StaticSemaphore_t storage_mutex_buffer;
+};
+
+/**
+ * @brief Size of the RAM buffers in multiples of the SPIFFS page size.
+ *
+ * @param size_multiple number of SPIFFS pages
+ */
+#define DATA_STORE_BUFFER_SIZE(size_multiple)                                  \
+  ((size_multiple) * CONFIG_SPIFFS_PAGE_SIZE)
+
+/**
+ * @brief Define a data store and statically allocate its buffers.
+ *
+ * @param store_var name of the defined struct data_store_t variable
+ * @param store_name name of the stream used for logging
+ * @param id id of the stream, see data_store_stream_id
+ * @param item_type type of one record
+ * @param item_fields array of struct data_store_field_t describing the record
+ * @param directory directory holding the segment files
+ * @param size size of both RAM buffers in bytes, see DATA_STORE_BUFFER_SIZE
+ * @param quota_bytes maximum bytes of the segments on the storage
+ */
+#define DATA_STORE_DEFINE(store_var, store_name, id, item_type, item_fields,   \
+                          directory, size, quota_bytes)                        \
+  _Static_assert(sizeof(item_fields) / sizeof(item_fields[0]) <=               \
+                     DATA_STORE_MAX_FIELDS,                                    \
+                 "Too many fields");                                           \
+  _Static_assert(sizeof(item_type) <= DATA_STORE_MAX_ITEM_SIZE,                \
+                 "Record too large");                                          \
+  static uint8_t store_var##_items_[size];                                     \
+  static item_type store_var##_in_flight_[DATA_STORE_MAX_IN_FLIGHT];          \
+  static RTC_NOINIT_ATTR struct data_store_rtc_tail_t store_var##_rtc_tail_;   \
+  static item_type                                                             \
+      store_var##_replay_items_[DATA_STORE_REPLAY_WINDOW_SIZE /                \
+                                sizeof(item_type)];                            \
+  static struct data_store_t store_var = {                                     \
+      .name = store_name,                                                      \
+      .stream_id = id,                                                         \
+      .dir_path = directory,                                                   \
+      .item_size = sizeof(item_type),                                          \
+      .fields = item_fields,                                                   \
+      .nr_fields = sizeof(item_fields) / sizeof(item_fields[0]),               \
+      .buffer_size = size,                                                     \
+      .quota = quota_bytes,                                                    \
+      .buffers = {{.items = store_var##_items_},                               \
+                  {.items = store_var##_items_ + (size) / 2}},                 \
+      .in_flight_items = (uint8_t *)store_var##_in_flight_,                    \
+      .rtc_tail = &store_var##_rtc_tail_,                                      \
+      .replay_items = (uint8_t *)store_var##_replay_items_,                    \
+  }
+
+/**
+ * @brief Mount the storage partition of the selected backend.
+ *
+ * Needs to be called once before any store is initialized. The time needed is
+ * written to the log.
+ *
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t data_store_mount_storage();
+
+/**
+ * @brief Do maintenance work on the storage while the data logging is idle.
+ *
+ * With SPIFFS, the garbage collection frees pages for the next segments.
+ */
+void data_store_idle();
+
+/**
+ * @brief Initialize the data store.
+ *
+ * Creates the mutex and recovers the segments which are left on the storage
+ * from a previous run. Records left in the RTC tail buffer by a soft reset are
+ * pushed again.
+ *
+ * @param store store to initialize
+ */
+void data_store_init(struct data_store_t *store);
+
+/**
+ * @brief Get the next sequence number of the stream of a store.
+ *
+ * The sequence numbers increase by one for each call and never repeat, even
+ * over a reboot. Blocks of DATA_STORE_SEQUENCE_BLOCK numbers are reserved in
+ * NVS, so a reboot skips the rest of the current block.
+ *
+ * @param store store of the stream
+ * @return uint32_t the sequence number
+ */
+uint32_t data_store_next_sequence(struct data_store_t *store);
+
+/**
+ * @brief Push a new record onto the store.
+ *
+ * If the active RAM buffer is full, it is handed to the writer task and the
+ * record is pushed to the other buffer. If the other buffer is neither drained
+ * nor written yet, the record is dropped. The call never waits for the
+ * storage.
+ *
+ * @param store store to push to
+ * @param item record of store->item_size bytes
+ */
+void data_store_push(struct data_store_t *store, const void *item);
+
+/**
+ * @brief Read the next record from the store without removing it.
+ *
+ * Records are read in the order they were pushed. The oldest segment on the
+ * storage is replayed first, afterwards the RAM buffers are drained. If the
+ * segments are shipped, only the RAM buffers are drained. Read records are
+ * kept by the store until they are committed, at most DATA_STORE_MAX_IN_FLIGHT
+ * records at once.
+ *
+ * @param store store to read from
+ * @param item output for the read record of store->item_size bytes
+ * @return true if a record was read, false if the store is empty or too many
+ * records are not committed
+ */
+bool data_store_read(struct data_store_t *store, void *item);
+
+/**
+ * @brief Remove the oldest read records from the store.
+ *
+ * @param store store to commit
+ * @param nr_records number of records to remove
+ */
+void data_store_commit(struct data_store_t *store, unsigned int nr_records);
+
+/**
+ * @brief Read all records which are not committed again.
+ *
+ * The next data_store_read starts with the oldest record which is not
+ * committed.
+ *
+ * @param store store to roll back
+ */
+void data_store_rollback(struct data_store_t *store);
+
+/**
+ * @brief Check if no record waits in the store.
+ *
+ * Does not wait for the storage. If a segment is being written, the store is
+ * not empty anyway.
+ *
+ * @param store store to check
+ * @return true if the store holds no record
+ */
+bool data_store_is_empty(struct data_store_t *store);
+
+/**
+ * @brief Callback receiving the records of a query.
+ *
+ * @param item record of store->item_size bytes
+ * @param context context given to the query
+ */
+typedef void (*data_store_record_cb_t)(const void *item, void *context);
+
+/**
+ * @brief Get the records of a time window without removing them.
+ *
+ * Records are passed to the callback in the order they were stored. Segments
+ * outside of the time window are skipped without reading them. A query which
+ * reached max_records is continued by passing its last_seq as after_seq, as
+ * the timestamps of the records are not necessarily in order.
+ *
+ * @param store store to query
+ * @param from start of the time window, inclusive
+ * @param to end of the time window, inclusive
+ * @param after_seq skip the records up to this sequence number, NULL for none
+ * @param max_records maximum number of records passed to the callback
+ * @param callback called for each record in the time window
+ * @param context passed to the callback
+ * @param last_seq output for the sequence number of the last passed record
+ * @return true if all records of the time window were passed
+ */
+bool data_store_query(struct data_store_t *store, time_t from, time_t to,
+                      const uint32_t *after_seq, unsigned int max_records,
+                      data_store_record_cb_t callback, void *context,
+                      uint32_t *last_seq);
+
+/**
+ * @brief Read the next chunk of a segment on the storage for shipping.
+ *
+ * Continues behind the previous chunk. If the previous chunk is empty or its
+ * segment was removed meanwhile, the first chunk of the oldest segment is
+ * read, preferring the stream of the previous chunk. The output starts with a
+ * struct data_store_chunk_header_t followed by the raw bytes of the segment.
+ *
+ * @param chunk previous chunk, updated to the read chunk
+ * @param out output for the chunk
+ * @param max_size size of out in bytes
+ * @return size_t number of bytes written to out, 0 if no segment is stored
+ */
+size_t data_store_read_chunk(struct data_store_chunk_t *chunk, uint8_t *out,
+                             size_t max_size);
+
+/**
+ * @brief Remove a completely shipped segment from the storage.
+ *
+ * Nothing is removed if the segment was already evicted.
+ *
+ * @param chunk any chunk of the segment
+ */
+void data_store_remove_segment(const struct data_store_chunk_t *chunk);
+
+/**
+ * @brief Write all records of the RAM buffers to the storage.
+ *
+ * Writes from the calling task and waits until the storage is written.
+ *
+ * @param store store to flush
+ */
+void data_store_flush(struct data_store_t *store);
+
+/**
+ * @brief Write the records of the RAM buffers of all stores to the storage.
+ *
+ * Called on shutdown to keep the records over a restart. The records read from
+ * the RAM buffers but not committed are written first, so they are sent again
+ * after the restart. Those read from a segment are replayed from it again.
+ * The RAM buffers of stores whose records are all mirrored in RTC memory are
+ * skipped, their records are restored from there after the restart.
+ */
+void data_store_flush_all();
+
+/**
+ * @brief Create the task writing full RAM buffers to the storage.
+ *
+ * @return TaskHandle_t handle of the created task
+ */
+TaskHandle_t data_store_create_writer_task();
+
+/**
+ * @brief Get the size and the usage of the storage holding the segments.
+ *
+ * @param total_bytes output for the size of the storage
+ * @param used_bytes output for the used bytes of the storage
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t data_store_storage_info(size_t *total_bytes, size_t *used_bytes);
+
+/**
+ * @brief Add the current storage usage of each stream to a JSON object.
+ *
+ * Adds an object per stream with the used bytes, the quota and the number of
+ * evicted segments since boot.
+ *
+ * @param data JSON object to add to
+ */
+void data_store_add_usage_json(cJSON *data);
+
+/**
+ * @brief Get the backlog of a store.
+ *
+ * The oldest record on the storage is taken from the header of its segment,
+ * so a partly replayed segment reports the time of its first record.
+ *
+ * @param store store to check
+ * @param stats output for the backlog
+ */
+void data_store_get_stats(struct data_store_t *store,
+                          struct data_store_stats_t *stats);
+
+/**
+ * @brief Create a JSON object with the fields shared by all records.
+ *
+ * Adds the board id, the timestamp, the sequence number and the quality of the
+ * timestamp of the record. Timestamps collected before the time was
+ * synchronized are rebased if possible, see data_clock_rebase.
+ *
+ * @param timestamp timestamp when the record was collected
+ * @param seq sequence number of the record in its stream
+ * @param boot_id boot the record was collected in
+ * @param is_clock_unsynced true if collected before the time was synchronized
+ * @return cJSON* JSON object which needs to be deleted by the caller
+ */
+cJSON *data_store_create_json(time_t timestamp, uint32_t seq, uint16_t boot_id,
+                              bool is_clock_unsynced);
+
+/**
+ * @brief Add the published fields of a record to a JSON object.
+ *
+ * Fields are added in the order of their description, see
+ * DATA_STORE_PUBLISHED_FIELD.
+ *
+ * @param store store the record belongs to
+ * @param item record to add
+ * @param data JSON object to add to
+ */
+void data_store_add_fields_json(const struct data_store_t *store,
+                                const void *item, cJSON *data);
+
+#if CONFIG_MQTT_DATA_LOGGING_BENCHMARK
+/**
+ * @brief Measure the write and replay throughput of the storage backend.
+ *
+ * The result is written to the log.
+ */
+void data_store_benchmark();
+#endif
+
+#endif /* COMPONENTS_MQTT5_CONNECTION_INCLUDE_DATA_STORE */
@@ -18,6 +18,39 @@ void mqtt5_conn_init();
  */
 int mqtt5_sent_message(const char *topic, const char *data);
 
+/**
+ * @brief Send a message with the given QoS to the MQTT broker.
+ *
+ * @param topic topic to which the message is sent.
+ * @param data data to send.
+ * @param qos QoS of the message, 0 or 1.
+ * @return int message id of the sent message. Negative if failed.
+ */
+int mqtt5_sent_message_qos(const char *topic, const char *data, int qos);
+
+/**
+ * @brief Send a binary message to the MQTT broker.
+ *
+ * @param topic topic to which the message is sent.
+ * @param data data to send.
+ * @param length length of the data in bytes.
+ * @return int message id of the sent message. Negative if failed.
+ */
+int mqtt5_sent_binary(const char *topic, const uint8_t *data, int length);
+
+/**
+ * @brief Send a response to a request to the MQTT broker.
+ *
+ * @param topic response topic of the request.
+ * @param data data to send.
+ * @param correlation_data correlation data of the request.
+ * @param correlation_data_len length of the correlation data.
+ * @return int message id of the sent message. Negative if failed.
+ */
+int mqtt5_sent_response(const char *topic, const char *data,
+                        const char *correlation_data,
+                        int correlation_data_len);
+
 /**
  * @brief Task to check the connection and retry if it fails.
  *
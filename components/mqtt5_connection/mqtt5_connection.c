@@ -1,6 +1,7 @@
 #include "mqtt5_connection.h"
 
 #include "config_connection.h"
+#include "data_query.h"
 #include "data_logging.h"
 #include "esp_app_desc.h"
 #include "esp_log.h"
@@ -119,6 +120,18 @@ static void print_user_property(mqtt5_user_property_handle_t user_property) {
   }
 }
 
+/**
+ * @brief Check if a received message belongs to a topic.
+ *
+ * @param event event of the received message
+ * @param topic topic to compare with
+ * @return true if the message was received on the topic
+ */
+static bool is_event_topic(esp_mqtt_event_handle_t event, const char *topic) {
+  return (size_t)event->topic_len == strlen(topic) &&
+         strncmp(event->topic, topic, event->topic_len) == 0;
+}
+
 /**
  * @brief Event handler for all mqtt events
  *
@@ -144,6 +157,7 @@ static void mqtt5_event_handler(void *handler_args, esp_event_base_t base,
     ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
     print_user_property(event->property->user_property);
     subscribe_to_config_channel(client);
+    subscribe_to_data_query_channel(client);
     send_status_connected(client);
     send_current_configuration(client);
     set_connected();
@@ -185,7 +199,11 @@ static void mqtt5_event_handler(void *handler_args, esp_event_base_t base,
   case MQTT_EVENT_DATA:
     ESP_LOGD(TAG, "MQTT_EVENT_DATA");
     print_user_property(event->property->user_property);
-    if (strcmp(event->topic, CONFIG_MQTT_CONFIG_RECEIVE_TOPIC)) {
+    if (is_event_topic(event, CONFIG_MQTT_DATA_QUERY_TOPIC)) {
+      new_data_query_received_cb(event);
+      break;
+    }
+    if (is_event_topic(event, CONFIG_MQTT_CONFIG_RECEIVE_TOPIC)) {
       new_configuration_received_cb(event);
       break;
     }
@@ -227,6 +245,10 @@ static void mqtt5_event_handler(void *handler_args, esp_event_base_t base,
 }
 
 int mqtt5_sent_message(const char *topic, const char *data) {
+  return mqtt5_sent_message_qos(topic, data, 1);
+}
+
+int mqtt5_sent_message_qos(const char *topic, const char *data, int qos) {
   if (!mqtt5_connected) {
     return -1;
   }
@@ -243,7 +265,7 @@ int mqtt5_sent_message(const char *topic, const char *data) {
   esp_mqtt5_client_set_user_property(&config_publish_property.user_property,
                                      user_property_arr, USE_PROPERTY_ARR_SIZE);
   esp_mqtt5_client_set_publish_property(client_, &config_publish_property);
-  int msg_id = esp_mqtt_client_enqueue(client_, topic, data, 0, 1, 1, true);
+  int msg_id = esp_mqtt_client_enqueue(client_, topic, data, 0, qos, 1, true);
 
   esp_mqtt5_client_delete_user_property(config_publish_property.user_property);
   config_publish_property.user_property = NULL;
@@ -251,6 +273,62 @@ int mqtt5_sent_message(const char *topic, const char *data) {
   return msg_id;
 }
 
+int mqtt5_sent_binary(const char *topic, const uint8_t *data, int length) {
+  if (!mqtt5_connected) {
+    return -1;
+  }
+
+  static esp_mqtt5_publish_property_config_t binary_publish_property = {
+      .payload_format_indicator = 0,
+      .message_expiry_interval = 1000,
+      .topic_alias = 0,
+      .response_topic = NULL,
+      .correlation_data = NULL,
+      .correlation_data_len = 0,
+  };
+
+  esp_mqtt5_client_set_user_property(&binary_publish_property.user_property,
+                                     user_property_arr, USE_PROPERTY_ARR_SIZE);
+  esp_mqtt5_client_set_publish_property(client_, &binary_publish_property);
+  int msg_id = esp_mqtt_client_enqueue(client_, topic, (const char *)data,
+                                       length, 1, 0, true);
+
+  esp_mqtt5_client_delete_user_property(binary_publish_property.user_property);
+  binary_publish_property.user_property = NULL;
+  ESP_LOGD(TAG, "sent binary data, msg_id=%d", msg_id);
+  return msg_id;
+}
+
+int mqtt5_sent_response(const char *topic, const char *data,
+                        const char *correlation_data,
+                        int correlation_data_len) {
+  if (!mqtt5_connected) {
+    return -1;
+  }
+
+  static esp_mqtt5_publish_property_config_t response_publish_property = {
+      .payload_format_indicator = 1,
+      .message_expiry_interval = 1000,
+      .topic_alias = 0,
+      .response_topic = NULL,
+      .correlation_data = NULL,
+      .correlation_data_len = 0,
+  };
+
+  response_publish_property.correlation_data = correlation_data;
+  response_publish_property.correlation_data_len = correlation_data_len;
+  esp_mqtt5_client_set_user_property(&response_publish_property.user_property,
+                                     user_property_arr, USE_PROPERTY_ARR_SIZE);
+  esp_mqtt5_client_set_publish_property(client_, &response_publish_property);
+  int msg_id = esp_mqtt_client_enqueue(client_, topic, data, 0, 1, 0, true);
+
+  esp_mqtt5_client_delete_user_property(
+      response_publish_property.user_property);
+  response_publish_property.user_property = NULL;
+  ESP_LOGD(TAG, "sent response, msg_id=%d", msg_id);
+  return msg_id;
+}
+
 void mqtt5_conn_init() {
   data_logging_init();
 
@@ -5,6 +5,7 @@
 #include "data_logging.h"
 #include "driver/gpio.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "sdkconfig.h"
 #include <math.h>
 #include <stdio.h>
@@ -111,6 +112,9 @@ void pump_control_task(void *pvParameters) {
   static enum State state = WAITING;
   stop_pump();
   static time_t pumping_start_time;
+  // monotonic start and planned duration of the cycle for its record
+  static int64_t pumping_start_us;
+  static uint32_t planned_s;
   static time_t now;
 
   for (;;) {
@@ -123,8 +127,17 @@ void pump_control_task(void *pvParameters) {
       if (time_diff_s >= configuration.pump_cycles.pump_time_s) {
         stop_pump();
         state = WAITING;
+        const uint32_t actual_s =
+            (esp_timer_get_time() - pumping_start_us) / 1000000;
+        add_pump_cycle_item(planned_s, actual_s,
+                            configuration.pump_cycles.pump_time_s == planned_s
+                                ? DATA_LOGGING_PUMP_END_COMPLETED
+                                : DATA_LOGGING_PUMP_END_RECONFIGURED);
         ESP_LOGI(TAG, "Stop pump");
       } else {
+        // Log the duration so far if the device restarts during the cycle
+        save_pump_cycle_progress((esp_timer_get_time() - pumping_start_us) /
+                                 1000000);
         // wait for stop
         const int wait_time_s =
             floor((configuration.pump_cycles.pump_time_s - time_diff_s) * 0.9);
@@ -158,7 +171,10 @@ void pump_control_task(void *pvParameters) {
             state = PUMPING;
             last_run = times_minutes_per_day[i];
             time(&pumping_start_time); // update start time
+            pumping_start_us = esp_timer_get_time();
+            planned_s = configuration.pump_cycles.pump_time_s;
             start_pump();
+            save_pump_cycle_start(planned_s);
             ESP_LOGI(TAG, "Start pump, curr_min=%i, i=%i, conf=%i", curr_min, i,
                      times_minutes_per_day[i]);
             break;
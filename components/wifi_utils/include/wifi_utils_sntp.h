@@ -1,10 +1,37 @@
 #ifndef COMPONENTS_WIFI_UTILS_INCLUDE_WIFI_UTILS_SNTP_H
 #define COMPONENTS_WIFI_UTILS_INCLUDE_WIFI_UTILS_SNTP_H
 
+#include <stdbool.h>
+
+/**
+ * @brief Callback if the time was synchronized the first time.
+ *
+ */
+typedef void (*wifi_utils_time_synced_cb_t)(void);
+
 /**
  * @brief Initialize the connection to the SNTP Server to synchronize the time.
  *
+ * Until the time is synchronized, the clock starts at a fixed date.
+ *
  */
 void wifi_utils_init_sntp(void);
 
+/**
+ * @brief Check if the time was synchronized over SNTP.
+ *
+ * @return true if the time was synchronized at least once since boot
+ */
+bool wifi_utils_is_time_synced(void);
+
+/**
+ * @brief Set the callback called once the time is synchronized the first time.
+ *
+ * The callback is called from the SNTP task. It is not called if the time is
+ * already synchronized.
+ *
+ * @param cb callback to call
+ */
+void wifi_utils_set_time_synced_cb(wifi_utils_time_synced_cb_t cb);
+
 #endif /* COMPONENTS_WIFI_UTILS_INCLUDE_WIFI_UTILS_SNTP_H */
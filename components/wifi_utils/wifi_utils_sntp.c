@@ -4,12 +4,38 @@
 #include "esp_log.h"
 #include "esp_netif_sntp.h"
 #include "freertos/FreeRTOS.h"
+#include <stdatomic.h>
 #include <string.h>
 #include <sys/time.h>
 #include <time.h>
 
 static const char *TAG = "wifi_sntp";
 
+/** @brief Set after the first synchronization of the time. */
+static atomic_bool is_time_synced_ = false;
+/** @brief Called after the first synchronization of the time. */
+static wifi_utils_time_synced_cb_t time_synced_cb_ = NULL;
+
+/**
+ * @brief Callback of the SNTP client after the time was set.
+ *
+ * @param tv the new time
+ */
+static void time_sync_notification_cb(struct timeval *tv) {
+  if (!atomic_exchange(&is_time_synced_, true)) {
+    ESP_LOGI(TAG, "Time synchronized the first time");
+    if (time_synced_cb_ != NULL) {
+      time_synced_cb_();
+    }
+  }
+}
+
+bool wifi_utils_is_time_synced(void) { return atomic_load(&is_time_synced_); }
+
+void wifi_utils_set_time_synced_cb(wifi_utils_time_synced_cb_t cb) {
+  time_synced_cb_ = cb;
+}
+
 void wifi_utils_init_sntp(void) {
   setenv("TZ", CONFIG_LOCAL_TIME_ZONE, 1);
   tzset();
@@ -19,8 +45,8 @@ void wifi_utils_init_sntp(void) {
       .tm_min = 0,
       .tm_hour = 0,
       .tm_mday = 1,
-      .tm_mon = 1,
-      .tm_year = 2025,
+      .tm_mon = 0,            // January
+      .tm_year = 2025 - 1900, // years since 1900
   };
   // initialize time as 10 min before the first pump cycle.
   // just in case the time is not set over SNTP we start pumping soon.
@@ -42,6 +68,7 @@ void wifi_utils_init_sntp(void) {
 
   esp_sntp_config_t config =
       ESP_NETIF_SNTP_DEFAULT_CONFIG(CONFIG_WIFI_SNTP_POOL_SERVER);
+  config.sync_cb = time_sync_notification_cb;
   esp_netif_sntp_init(&config);
   while (esp_netif_sntp_sync_wait(CONFIG_WIFI_SNTP_INIT_WAIT_TIME_MS /
                                   portTICK_PERIOD_MS) == ESP_ERR_TIMEOUT) {
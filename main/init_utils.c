@@ -1,6 +1,5 @@
+#include "data_store.h"
 #include "esp_log.h"
-#include "esp_spiffs.h"
-#include "esp_vfs.h"
 #include <esp_err.h>
 #include <nvs_flash.h>
 
@@ -19,21 +18,9 @@ static inline void initialize_nvs() {
 }
 
 /**
- * @brief Initialize th SPIFFS filesystem for storing logging data.
+ * @brief Mount the storage partition for storing logging data.
  *
  */
-static inline void initialize_spiffs_storage() {
-  const char *base_path = "/store";
-  const esp_vfs_spiffs_conf_t mount_config = {.base_path = base_path,
-                                              .partition_label = "storage",
-                                              .max_files = 2,
-                                              .format_if_mount_failed = true};
-  esp_err_t ret = esp_vfs_spiffs_register(&mount_config);
-
-  if (ret != ESP_OK) {
-    ESP_LOGE("SPIFFS", "Failed to mount SPIFFS filesystem: %s",
-             esp_err_to_name(ret));
-  } else {
-    ESP_LOGD("SPIFFS", "SPIFFS filesystem mounted successfully");
-  }
+static inline void initialize_data_storage() {
+  ESP_ERROR_CHECK_WITHOUT_ABORT(data_store_mount_storage());
 }
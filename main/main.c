@@ -21,7 +21,7 @@ void app_main(void) {
   initialize_light_control();
   // Initialize storage
   initialize_nvs();
-  initialize_spiffs_storage();
+  initialize_data_storage();
 
   load_configuration();
 
@@ -0,0 +1,306 @@
+import argparse
+import datetime
+import json
+import struct
+import sys
+import zlib
+
+# Header in front of each shipped chunk per chunk version, see struct
+# data_store_chunk_header_t. Version 1 had room for 8 field types.
+CHUNK_HEADERS = {
+    1: struct.Struct("<4BIIB8s3x"),
+    2: struct.Struct("<4BIIB11s"),
+}
+CHUNK_LAST = 0x01
+
+# Header at the start of each segment, see struct data_store_segment_header_t.
+SEGMENT_HEADER = struct.Struct("<IBB2xIIqq")
+SEGMENT_MAGIC = 0x45465331
+SEGMENT_FORMAT = 2
+SEGMENT_CRC_OFFSET = 12
+
+# Field types, see enum data_store_field_type.
+FIELD_UNSIGNED = 0
+FIELD_SIGNED = 1
+FIELD_BOOL = 2
+FIELD_TIME = 3
+FIELD_SEQUENCE = 4
+
+# Names of the streams and their fields, see enum data_store_stream_id.
+STREAMS = {
+    0: ("pump", ["ts", "pump_on", "seq", "boot_id", "clock_unsynced"]),
+    1: ("light", ["ts", "intensity", "seq", "boot_id", "clock_unsynced"]),
+    2: (
+        "memory",
+        [
+            "ts",
+            "free_heap_size",
+            "min_free_heap_size",
+            "store_used_bytes",
+            "seq",
+            "boot_id",
+            "clock_unsynced",
+            "largest_free_block",
+            "rssi",
+        ],
+    ),
+    3: (
+        "rollup",
+        [
+            "ts",
+            "seq",
+            "boot_id",
+            "clock_unsynced",
+            "period",
+            "seconds",
+            "pump_on_s",
+            "pump_cycles",
+            "light_dose",
+            "min_free_heap_size",
+            "max_free_heap_size",
+        ],
+    ),
+    4: (
+        "pump_cycle",
+        [
+            "ts",
+            "seq",
+            "boot_id",
+            "clock_unsynced",
+            "planned_s",
+            "actual_s",
+            "end_reason",
+        ],
+    ),
+}
+
+MASK_64 = (1 << 64) - 1
+
+
+def read_varint(data: bytes, pos: int) -> tuple:
+    """Read a varint.
+        Args:
+            data (bytes): Encoded data.
+            pos (int): Position to read from.
+        Returns:
+            tuple: Value and position behind the varint.
+    """
+    value = 0
+    shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        if byte & 0x80 == 0:
+            return value, pos
+        shift += 7
+
+
+def to_signed(value: int) -> int:
+    """Interpret a 64 bit value as two's complement."""
+    return value - (1 << 64) if value >> 63 else value
+
+
+def decode_segment(data: bytes, field_types: list) -> tuple:
+    """Decode all records of a segment.
+        Args:
+            data (bytes): Raw bytes of the segment.
+            field_types (list): Type of each field of a record.
+        Returns:
+            tuple: Segment header as dict and list of records, each a list of field values.
+    """
+    if len(data) < SEGMENT_HEADER.size:
+        raise ValueError("Segment too short for its header")
+    magic, fmt, stream_id, nr_records, crc, min_time, max_time = SEGMENT_HEADER.unpack_from(data)
+    if magic != SEGMENT_MAGIC or fmt != SEGMENT_FORMAT:
+        raise ValueError(f"Unknown segment magic {magic:#x} or format {fmt}")
+    header_data = bytearray(data[: SEGMENT_HEADER.size])
+    header_data[SEGMENT_CRC_OFFSET : SEGMENT_CRC_OFFSET + 4] = bytes(4)
+    if zlib.crc32(header_data) != crc:
+        raise ValueError("Segment header crc mismatch")
+    header = {
+        "format": fmt,
+        "stream_id": stream_id,
+        "nr_records": nr_records,
+        "min_time": min_time,
+        "max_time": max_time,
+    }
+    pos = SEGMENT_HEADER.size
+
+    records = []
+    values = [0] * len(field_types)
+    while pos < len(data):
+        changed, pos = read_varint(data, pos)
+        for i, field_type in enumerate(field_types):
+            if not (changed >> i) & 1:
+                continue
+            if field_type == FIELD_BOOL:
+                values[i] = 0 if values[i] else 1
+            else:
+                delta, pos = read_varint(data, pos)
+                # zigzag decoding
+                delta = (delta >> 1) ^ (-(delta & 1) & MASK_64)
+                values[i] = (values[i] + delta) & MASK_64
+        record = []
+        for value, field_type in zip(values, field_types):
+            if field_type == FIELD_BOOL:
+                record.append(bool(value))
+            elif field_type in (FIELD_UNSIGNED, FIELD_SEQUENCE):
+                record.append(value)
+            else:
+                record.append(to_signed(value))
+        records.append(record)
+    return header, records
+
+
+def record_to_dict(board_id: int, stream_id: int, field_types: list, record: list) -> dict:
+    """Convert a decoded record to a dict with the field names of the stream.
+        Args:
+            board_id (int): Id of the board.
+            stream_id (int): Id of the stream.
+            field_types (list): Type of each field of the record.
+            record (list): Field values of the record.
+        Returns:
+            dict: Record with named fields. Timestamps are converted to ISO 8601.
+    """
+    stream_name, field_names = STREAMS.get(stream_id, (f"stream_{stream_id}", []))
+    result = {"id": board_id, "stream": stream_name}
+    for i, (value, field_type) in enumerate(zip(record, field_types)):
+        name = field_names[i] if i < len(field_names) else f"field_{i}"
+        if field_type == FIELD_TIME:
+            value = datetime.datetime.fromtimestamp(value, datetime.timezone.utc).isoformat()
+        result[name] = value
+    return result
+
+
+class ChunkAssembler:
+    """Collects the chunks of shipped segments and decodes completed segments."""
+
+    def __init__(self):
+        self.segments = {}
+
+    def add(self, payload: bytes) -> list:
+        """Add the payload of one bulk message.
+            Args:
+                payload (bytes): Payload of the message.
+            Returns:
+                list: Decoded records as dicts if the chunk completed a segment.
+        """
+        chunk_header = CHUNK_HEADERS.get(payload[0])
+        if chunk_header is None:
+            raise ValueError(f"Unknown chunk version {payload[0]}")
+        _, board_id, stream_id, flags, location, offset, nr_fields, types = (
+            chunk_header.unpack_from(payload)
+        )
+        field_types = list(types[:nr_fields])
+        key = (board_id, stream_id, location)
+        if offset == 0:
+            # A segment is shipped again from its start after a reconnect.
+            self.segments[key] = bytearray()
+        segment = self.segments.get(key)
+        if segment is None or len(segment) != offset:
+            print(f"Dropping chunk of {key} at offset {offset}", file=sys.stderr)
+            self.segments.pop(key, None)
+            return []
+        segment += payload[chunk_header.size :]
+        if not flags & CHUNK_LAST:
+            return []
+        del self.segments[key]
+        _, records = decode_segment(bytes(segment), field_types)
+        return [record_to_dict(board_id, stream_id, field_types, r) for r in records]
+
+
+def decode_files(file_names: list) -> None:
+    """Decode bulk message payloads saved as files, in the given order.
+        Args:
+            file_names (list): Files holding one payload each.
+    """
+    assembler = ChunkAssembler()
+    for file_name in file_names:
+        with open(file_name, "rb") as file:
+            for record in assembler.add(file.read()):
+                print(json.dumps(record))
+
+
+def decode_from_broker(host: str, port: int, topic: str, username: str, password: str) -> None:
+    """Subscribe to the bulk topic and print the decoded records.
+        Args:
+            host (str): Address of the MQTT broker.
+            port (int): Port of the MQTT broker.
+            topic (str): Topic of the bulk messages.
+            username (str): Username for the broker, None to connect anonymously.
+            password (str): Password for the broker.
+    """
+    import paho.mqtt.client as mqtt
+
+    assembler = ChunkAssembler()
+
+    def on_connect(client, userdata, flags, reason_code, properties):
+        client.subscribe(topic, qos=1)
+
+    def on_message(client, userdata, message):
+        for record in assembler.add(message.payload):
+            print(json.dumps(record), flush=True)
+
+    client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2, protocol=mqtt.MQTTv5)
+    if username is not None:
+        client.username_pw_set(username, password)
+    client.on_connect = on_connect
+    client.on_message = on_message
+    client.connect(host, port)
+    client.loop_forever()
+
+
+if __name__ == "__main__":
+    arg_parser = argparse.ArgumentParser(
+        description="Decodes the stored data segments shipped in bulk and prints one json record per line."
+    )
+    arg_parser.add_argument(
+        "--files",
+        type=str,
+        nargs="+",
+        required=False,
+        help="Files holding the payload of one bulk message each, in the order they were received.",
+    )
+    arg_parser.add_argument(
+        "--broker",
+        type=str,
+        required=False,
+        help="Address of the MQTT broker to receive the bulk messages from.",
+    )
+    arg_parser.add_argument(
+        "--port",
+        type=int,
+        required=False,
+        default=1883,
+        help="Port of the MQTT broker.",
+    )
+    arg_parser.add_argument(
+        "--topic",
+        type=str,
+        required=False,
+        default="ef/efc/data/bulk",
+        help="Topic of the bulk messages.",
+    )
+    arg_parser.add_argument(
+        "--username",
+        type=str,
+        required=False,
+        default=None,
+        help="Username for the MQTT broker.",
+    )
+    arg_parser.add_argument(
+        "--password",
+        type=str,
+        required=False,
+        default=None,
+        help="Password for the MQTT broker.",
+    )
+    args = arg_parser.parse_args()
+
+    if args.files:
+        decode_files(args.files)
+    elif args.broker:
+        decode_from_broker(args.broker, args.port, args.topic, args.username, args.password)
+    else:
+        arg_parser.error("Either --files or --broker is required.")